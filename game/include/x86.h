@@ -17,6 +17,14 @@ out_byte(uint16_t port, int8_t data) {
 	asm volatile("out %%al, %%dx" : : "a"(data), "d"(port));
 }
 
+/* 读时间戳计数器 */
+static inline uint64_t
+rdtsc(void) {
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
 /* 打开外部中断 */
 static inline void
 sti(void) {
@@ -3,10 +3,20 @@
 #define TIMER_PORT 0x40
 #define FREQ_8253 1193182
 
+/* the RTC of NEMU, whose third register is the frequency of rdtsc */
+#define RTC_ADDR 0x8001000
+#define RTC_TSC_HZ 2
+
+uint32_t tsc_per_ms;
+
 void init_timer() {
 	int counter = FREQ_8253 / 100;
 	assert(counter < 65536);
 	out_byte(TIMER_PORT + 3, 0x34);
 	out_byte(TIMER_PORT + 0, counter % 256);
 	out_byte(TIMER_PORT + 0, counter / 256);
+
+	/* 32-bit, so that users of it need no 64-bit division */
+	tsc_per_ms = ((volatile uint32_t *)RTC_ADDR)[RTC_TSC_HZ] / 1000;
+	assert(tsc_per_ms > 0);
 }
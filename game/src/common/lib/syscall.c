@@ -10,27 +10,32 @@ syscall(int id, ...) {
 	return ret;
 }
 
+void sync(void);
+
 void _exit(int status) {
+	/* write back what the kernel still holds before stopping */
+	sync();
 	nemu_assert(!status);
 }
 
 int open(const char *pathname, int flags) {
-	nemu_assert(0);
-	return 0; 
+	return syscall(SYS_open, pathname, flags); 
 }
 
 int read(int fd, char *buf, int len) {
-	nemu_assert(0);
-	return 0; 
+	return syscall(SYS_read, fd, buf, len); 
 }
 
 int write(int fd, char *buf, int len) {
 	return syscall(SYS_write, fd, buf, len); 
 }
 
+void sync(void) {
+	syscall(SYS_sync);
+}
+
 off_t lseek(int fd, off_t offset, int whence) {
-	nemu_assert(0);
-	return 0; 
+	return syscall(SYS_lseek, fd, offset, whence); 
 }
 
 void *sbrk(int incr) {
@@ -48,9 +53,19 @@ void *sbrk(int incr) {
 	return prev_heap_end;
 }
 
+/* Only read-only mappings of files are supported. The arguments
+ * are passed in memory, as the old mmap() of i386 does. */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+	uint32_t args[6] = {(uint32_t)addr, len, prot, flags, fd, offset};
+	return (void *)syscall(SYS_mmap, args);
+}
+
+int munmap(void *addr, size_t len) {
+	return syscall(SYS_munmap, addr, len);
+}
+
 int close(int fd) {
-	nemu_assert(0);
-	return 0; 
+	return syscall(SYS_close, fd); 
 }
 
 int fstat(int fd, struct stat *buf) {
@@ -23,13 +23,27 @@ timer_event(void) {
 	}
 }
 
+/* The time-stamp counter of NEMU is driven by the virtual clock,
+ * its frequency is read from the RTC by init_timer(). */
+extern uint32_t tsc_per_ms;
+
+/* The game is linked without libgcc, so the 64-bit counter is divided
+ * with divl. The high word is reduced first to keep the quotient in
+ * 32 bits, which wraps around like the ticks of SDL do.
+ */
 uint32_t SDL_GetTicks() {
-	/* TODO: Return the time in millisecond. */
-	assert(0);
-	return 0;
+	uint64_t tsc = rdtsc();
+	uint32_t hi = (uint32_t)(tsc >> 32) % tsc_per_ms;
+	uint32_t ms, rem;
+	asm volatile("divl %4" : "=a"(ms), "=d"(rem) : "a"((uint32_t)tsc), "d"(hi), "rm"(tsc_per_ms));
+	return ms;
 }
 
+/* Sleep until the next interrupt instead of spinning on rdtsc, the
+ * timer interrupt wakes the CPU at least every 1000 / HZ ms. */
 void SDL_Delay(uint32_t ms) {
-	/* TODO: Return from this function after waiting for `ms' milliseconds. */
-	assert(0);
+	uint64_t end = rdtsc() + (uint64_t)ms * tsc_per_ms;
+	while(rdtsc() < end) {
+		wait_intr();
+	}
 }
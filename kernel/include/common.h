@@ -4,6 +4,12 @@
 /* Uncomment these macros to enable corresponding functionality. */
 //#define IA32_SEG
 //#define IA32_PAGE
+
+/* Map the kernel with 4MB pages, which needs CR4 and the PSE page walk.
+ * NEMU in this tree models neither, so this path can not be tested here;
+ * enable it only after the paging of NEMU supports both. */
+//#define IA32_PSE
+
 //#define IA32_INTR
 //#define HAS_DEVICE
 
@@ -3,6 +3,16 @@
 
 #include "common.h"
 
+/* Hardware interrupts are delivered at the vectors from IRQ_VECTOR_BASE,
+ * as the i8259 is programmed. There are no more than 16 of them. */
+#define IRQ_VECTOR_BASE 32
+#define NR_HARD_INTR 16
+
+/* Handlers of the same interrupt run in the order of their priorities,
+ * the smaller, the earlier. Drivers acknowledge their devices first. */
+#define IRQ_PRIO_DEVICE  0
+#define IRQ_PRIO_DEFAULT 10
+
 /* TODO: The decleration order of the members in the ``TrapFrame''
  * structure below is wrong. Please re-orgainize it for the C
  * code to use the trap frame correctly.
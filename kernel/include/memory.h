@@ -23,6 +23,10 @@
 #define make_pde(addr) ((((uint32_t)(addr)) & 0xfffff000) | 0x7)
 #define make_pte(addr) ((((uint32_t)(addr)) & 0xfffff000) | 0x7)
 
+/* a PDE mapping a 4MB page directly, with the PS bit set, used with IA32_PSE */
+#define make_large_pde(addr) ((((uint32_t)(addr)) & 0xffc00000) | 0x87)
+
 uint32_t mm_malloc(uint32_t, int len);
+void mm_free(uint32_t, int len);
 
 #endif
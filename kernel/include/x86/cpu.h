@@ -18,12 +18,40 @@ write_cr0(uint32_t cr0) {
 	asm volatile("movl %0, %%cr0" : : "r"(cr0));
 }
 
+/* read CR2, the linear address which causes the last page fault */
+static inline uint32_t
+read_cr2() {
+	uint32_t val;
+	asm volatile("movl %%cr2, %0" : "=r"(val));
+	return val;
+}
+
 /* write CR3, notice that CR3 is never read */
 static inline void
 write_cr3(uint32_t cr3) {
 	asm volatile("movl %0, %%cr3" : : "r"(cr3));
 }
 
+/* read CR4 */
+static inline uint32_t
+read_cr4() {
+	uint32_t val;
+	asm volatile("movl %%cr4, %0" : "=r"(val));
+	return val;
+}
+
+/* write CR4 */
+static inline void
+write_cr4(uint32_t cr4) {
+	asm volatile("movl %0, %%cr4" : : "r"(cr4));
+}
+
+/* invalidate the TLB entry of the page containing ``addr'' */
+static inline void
+invlpg(uint32_t addr) {
+	asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
 /* modify the value of GDTR */
 static inline void
 write_gdtr(void *addr, uint32_t size) {
@@ -44,6 +72,9 @@ write_idtr(void *addr, uint32_t size) {
 	asm volatile("lidt (%0)" : : "r"(data));
 }
 
+/* the interrupt enable flag in EFLAGS */
+#define FL_IF 0x200
+
 /* enable interrupt */
 static inline void
 sti(void) {
@@ -56,6 +87,14 @@ cli(void) {
 	asm volatile("cli");
 }
 
+/* read the time-stamp counter */
+static inline uint64_t
+rdtsc() {
+	uint64_t val;
+	asm volatile("rdtsc" : "=A"(val));
+	return val;
+}
+
 /* put the CPU into idle, waiting for the next interrupt */
 static inline void
 wait_intr() {
@@ -1,68 +1,294 @@
 #include "common.h"
-#define NR_SEC_BUF    128   /* sector buffer is a direct address hash */
+#include "memory.h"
+#include <string.h>
+
+/* The sector buffer is a set-associative cache with LRU replacement.
+ * It takes 1/64 of the physical memory.
+ */
+#define NR_SEC_BUF    (PHY_MEM / 64 / 512)
+#define NR_WAY        8
+#define NR_SET        (NR_SEC_BUF / NR_WAY)
+
+/* When misses hit consecutive sectors, the following sectors are read
+ * together. The window doubles on each sequential miss up to the maximum.
+ */
+#define READ_AHEAD_MIN  4
+#define READ_AHEAD_MAX  64
+
+/* Dirty sectors are kept in a list sorted by sector number, so that
+ * adjacent ones are written back by one command of at most WRITEBACK_MAX
+ * sectors. All of them are written back when the oldest one has been
+ * dirty for DIRTY_EXPIRE ticks, or when more than 1/DIRTY_RATIO of the
+ * buffer is dirty.
+ */
+#define WRITEBACK_MAX   64
+#define DIRTY_EXPIRE    100
+#define DIRTY_RATIO     8
 
 void disk_do_read(void *, uint32_t);
 void disk_do_write(void *, uint32_t);
+void disk_do_read_n(void *, uint32_t, int);
+void disk_do_write_n(void *, uint32_t, int);
+void buf_writeback(void);
+
+int add_bottom_half(void (*)(void));
+void raise_bottom_half(int);
 
 struct SectorBuf {
 	uint32_t sector;
 	bool used, dirty;
+	uint32_t last_use;		/* the time of the latest access, for LRU */
+	struct SectorBuf *dirty_prev, *dirty_next;
 	uint8_t content[512];
 };
-static struct SectorBuf buf[NR_SEC_BUF];
+static struct SectorBuf buf[NR_SET][NR_WAY];
+static uint32_t now = 0;
+
+static uint32_t last_miss = -1;
+static int ra_window = 0;
+static uint8_t ra_buf[READ_AHEAD_MAX * 512];
+
+static struct SectorBuf *dirty_head = NULL;
+static int nr_dirty = 0;
+static uint32_t ticks = 0, dirty_since;
+static int writeback_bh;
+static uint8_t wb_buf[WRITEBACK_MAX * 512];
+
+/* reported by the debug system call */
+static struct {
+	uint32_t hit, miss, eviction, read_ahead, writeback_cmd, writeback_sector;
+} buf_stat_cnt;
 
 void
 buf_init(void) {
-	int i;
-	for (i = 0; i < NR_SEC_BUF; i ++) {
-		buf[i].used = false;
+	memset(buf, 0, sizeof(buf));
+	memset(&buf_stat_cnt, 0, sizeof(buf_stat_cnt));
+	writeback_bh = add_bottom_half(buf_writeback);
+}
+
+static void
+dirty_insert(struct SectorBuf *ptr) {
+	struct SectorBuf *prev = NULL, *next = dirty_head;
+	while (next != NULL && next->sector < ptr->sector) {
+		prev = next;
+		next = next->dirty_next;
 	}
+
+	ptr->dirty_prev = prev;
+	ptr->dirty_next = next;
+	if (prev != NULL) { prev->dirty_next = ptr; } else { dirty_head = ptr; }
+	if (next != NULL) { next->dirty_prev = ptr; }
+
+	if (nr_dirty == 0) {
+		dirty_since = ticks;
+	}
+	nr_dirty ++;
 }
 
+static void
+dirty_remove(struct SectorBuf *ptr) {
+	if (ptr->dirty_prev != NULL) { ptr->dirty_prev->dirty_next = ptr->dirty_next; }
+	else { dirty_head = ptr->dirty_next; }
+	if (ptr->dirty_next != NULL) { ptr->dirty_next->dirty_prev = ptr->dirty_prev; }
+
+	ptr->dirty = false;
+	nr_dirty --;
+}
+
+/* Write back all dirty sectors, adjacent ones with one command. */
 void
 buf_writeback(void) {
+	while (dirty_head != NULL) {
+		uint32_t start = dirty_head->sector;
+		int n = 0;
+		while (dirty_head != NULL && dirty_head->sector == start + n && n < WRITEBACK_MAX) {
+			memcpy(wb_buf + n * 512, dirty_head->content, 512);
+			dirty_remove(dirty_head);
+			n ++;
+		}
+
+		disk_do_write_n(wb_buf, start, n);
+		buf_stat_cnt.writeback_cmd ++;
+		buf_stat_cnt.writeback_sector += n;
+	}
+}
+
+static void
+buf_mark_dirty(struct SectorBuf *ptr) {
+	if (ptr->dirty == false) {
+		ptr->dirty = true;
+		dirty_insert(ptr);
+		if (nr_dirty > NR_SEC_BUF / DIRTY_RATIO) {
+			buf_writeback();
+		}
+	}
+}
+
+/* Called at each timer tick. Waiting for the disk is impossible in the
+ * interrupt handler, so the writeback is done by a bottom half.
+ */
+void
+buf_tick(void) {
+	ticks ++;
+	if (nr_dirty > 0 && ticks - dirty_since >= DIRTY_EXPIRE) {
+		raise_bottom_half(writeback_bh);
+	}
+}
+
+static struct SectorBuf *
+buf_lookup(uint32_t sector) {
+	struct SectorBuf *set = buf[sector % NR_SET];
 	int i;
-	for (i = 0; i < NR_SEC_BUF; i ++) {
-		if (buf[i].dirty == true) {
-			disk_do_write(&buf[i].content, buf[i].sector);
-			buf[i].dirty = false;
+	for (i = 0; i < NR_WAY; i ++) {
+		if (set[i].used == true && set[i].sector == sector) {
+			return &set[i];
+		}
+	}
+	return NULL;
+}
+
+/* Find a free way in the set of ``sector'', or evict the least recently used one. */
+static struct SectorBuf *
+buf_alloc(uint32_t sector) {
+	struct SectorBuf *set = buf[sector % NR_SET];
+	struct SectorBuf *victim = &set[0];
+	int i;
+	for (i = 0; i < NR_WAY; i ++) {
+		if (set[i].used == false) {
+			victim = &set[i];
+			break;
+		}
+		if (set[i].last_use < victim->last_use) {
+			victim = &set[i];
+		}
+	}
+
+	if (victim->used == true) {
+		buf_stat_cnt.eviction ++;
+		if (victim->dirty == true) {
+			/* write back */
+			disk_do_write(&victim->content, victim->sector);
+			dirty_remove(victim);
+		}
+	}
+
+	victim->used = true;
+	victim->sector = sector;
+	victim->dirty = false;
+	return victim;
+}
+
+/* Read ``nr'' sectors from ``sector'' with one command, and put those
+ * not cached yet into the buffer. */
+static void
+buf_read_ahead(uint32_t sector, int nr) {
+	disk_do_read_n(ra_buf, sector, nr);
+
+	int i;
+	for (i = 0; i < nr; i ++) {
+		if (buf_lookup(sector + i) == NULL) {
+			struct SectorBuf *ptr = buf_alloc(sector + i);
+			memcpy(ptr->content, ra_buf + i * 512, 512);
+			/* older than anything used, so that useless
+			 * read-ahead is evicted first */
+			ptr->last_use = (i == 0 ? now : 0);
+			if (i > 0) {
+				buf_stat_cnt.read_ahead ++;
+			}
 		}
 	}
 }
 
 static struct SectorBuf *
 buf_fetch(uint32_t sector) {
-	struct SectorBuf *ptr = &buf[sector % NR_SEC_BUF];
-	
-	if (ptr->used == true && ptr->sector == sector) {
-		/* buf hit, do nothing */
+	struct SectorBuf *ptr = buf_lookup(sector);
+	now ++;
+
+	if (ptr != NULL) {
+		/* buf hit */
+		buf_stat_cnt.hit ++;
 	} else {
-		if (ptr->used == true && ptr->dirty == true) {
-			/* write back */
-			disk_do_write(&ptr->content, ptr->sector);
+		buf_stat_cnt.miss ++;
+
+		if (sector == last_miss + 1 || (ra_window > 0 && sector == last_miss + ra_window)) {
+			/* sequential access */
+			ra_window = (ra_window == 0 ? READ_AHEAD_MIN : ra_window * 2);
+			if (ra_window > READ_AHEAD_MAX) {
+				ra_window = READ_AHEAD_MAX;
+			}
+		} else {
+			ra_window = 0;
 		}
-		/* issue a read command */
-		disk_do_read(&ptr->content, sector);
+		last_miss = sector;
 
-		ptr->used = true;
-		ptr->sector = sector;
-		ptr->dirty = false;
+		if (ra_window > 0) {
+			buf_read_ahead(sector, ra_window);
+			ptr = buf_lookup(sector);
+		} else {
+			/* issue a read command */
+			ptr = buf_alloc(sector);
+			disk_do_read(&ptr->content, sector);
+		}
 	}
+
+	ptr->last_use = now;
 	return ptr;
 }
 
-uint8_t
-read_byte(uint32_t offset) {
-	uint32_t sector = offset >> 9;
+/* Copy ``len'' bytes at ``off'' of ``sector'' to ``dst''.
+ * The range should not cross the sector. */
+void
+buf_read(uint32_t sector, uint32_t off, void *dst, uint32_t len) {
 	struct SectorBuf *ptr = buf_fetch(sector);
-	return ptr->content[offset & 511];
+	memcpy(dst, ptr->content + off, len);
 }
 
 void
-write_byte(uint32_t offset, uint8_t data) {
-	uint32_t sector = offset >> 9;
-	struct SectorBuf *ptr = buf_fetch(sector);
-	ptr->content[offset & 511] = data;
-	ptr->dirty = true;
+buf_write(uint32_t sector, uint32_t off, const void *src, uint32_t len) {
+	struct SectorBuf *ptr;
+	if (off == 0 && len == 512) {
+		/* the whole sector is overwritten, no need to read it */
+		ptr = buf_lookup(sector);
+		if (ptr == NULL) {
+			buf_stat_cnt.miss ++;
+			ptr = buf_alloc(sector);
+		} else {
+			buf_stat_cnt.hit ++;
+		}
+		ptr->last_use = ++ now;
+	} else {
+		ptr = buf_fetch(sector);
+	}
+	memcpy(ptr->content + off, src, len);
+	buf_mark_dirty(ptr);
 }
 
+/* Read ``nr'' sectors into ``dst'' bypassing the buffer. Sectors modified
+ * in the buffer but not written back yet are copied from the buffer. */
+void
+buf_read_direct(void *dst, uint32_t sector, int nr) {
+	disk_do_read_n(dst, sector, nr);
+
+	int i;
+	for (i = 0; i < nr; i ++) {
+		struct SectorBuf *ptr = buf_lookup(sector + i);
+		if (ptr != NULL && ptr->dirty == true) {
+			memcpy(dst + i * 512, ptr->content, 512);
+		}
+	}
+}
+
+/* Copy the counters to ``stat'' (six words: hit, miss, eviction, sectors
+ * read ahead, writeback commands and sectors written back), or print
+ * them if ``stat'' is NULL. */
+void
+buf_stat(uint32_t *stat) {
+	if (stat == NULL) {
+		Log("sector buffer: %d hits, %d misses, %d evictions, %d sectors read ahead",
+				buf_stat_cnt.hit, buf_stat_cnt.miss, buf_stat_cnt.eviction, buf_stat_cnt.read_ahead);
+		Log("sector buffer: %d sectors written back by %d commands",
+				buf_stat_cnt.writeback_sector, buf_stat_cnt.writeback_cmd);
+	} else {
+		memcpy(stat, &buf_stat_cnt, sizeof(buf_stat_cnt));
+	}
+}
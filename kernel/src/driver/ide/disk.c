@@ -2,30 +2,46 @@
 #include "x86.h"
 
 //#define USE_DMA_READ
+//#define USE_DMA_WRITE
+
+#ifdef USE_DMA_READ
+#define DMA_READ true
+#else
+#define DMA_READ false
+#endif
+
+#ifdef USE_DMA_WRITE
+#define DMA_WRITE true
+#else
+#define DMA_WRITE false
+#endif
 
 #define IDE_PORT_BASE   0x1F0
 
-void dma_prepare(void *);
+/* the sector count register holds 8 bits, and 0 means 256 */
+#define MAX_SECTOR_PER_CMD 256
+
+void dma_prepare(void *, uint32_t);
 void dma_issue_read(void);
+void dma_issue_write(void);
 
 void clear_ide_intr(void);
 void wait_ide_intr(void);
 
+bool pvblk_present(void);
+void pvblk_read(void *, uint32_t, uint32_t);
+void pvblk_write(void *, uint32_t, uint32_t);
+
 static void waitdisk() {
 	while ( (in_byte(IDE_PORT_BASE + 7) & (0x80 | 0x40)) != 0x40);
 }
 
 static void
-ide_prepare(uint32_t sector) {
+ide_prepare(uint32_t sector, int nr, bool dma) {
 	waitdisk();
 
-#ifdef USE_DMA_READ
-	out_byte(IDE_PORT_BASE + 1, 1);
-#else
-	out_byte(IDE_PORT_BASE + 1, 0);
-#endif
-
-	out_byte(IDE_PORT_BASE + 2, 1);
+	out_byte(IDE_PORT_BASE + 1, dma ? 1 : 0);
+	out_byte(IDE_PORT_BASE + 2, nr & 0xFF);
 	out_byte(IDE_PORT_BASE + 3, sector & 0xFF);
 	out_byte(IDE_PORT_BASE + 4, (sector >> 8) & 0xFF);
 	out_byte(IDE_PORT_BASE + 5, (sector >> 16) & 0xFF);
@@ -44,39 +60,100 @@ issue_read() {
 
 static inline void
 issue_write() {
+#ifdef USE_DMA_WRITE
+	out_byte(IDE_PORT_BASE + 7, 0xca);
+	dma_issue_write();
+#else
 	out_byte(IDE_PORT_BASE + 7, 0x30);
+#endif
 }
 
-void
-disk_do_read(void *buf, uint32_t sector) {
+/* read ``nr'' (at most MAX_SECTOR_PER_CMD) sectors with a single command */
+static void
+disk_read_cmd(void *buf, uint32_t sector, int nr) {
 #ifdef USE_DMA_READ
-	dma_prepare(buf);
+	dma_prepare(buf, nr * 512);
 
 	clear_ide_intr();
 #endif
 
-	ide_prepare(sector);
+	ide_prepare(sector, nr, DMA_READ);
 	issue_read();
 
 #ifdef USE_DMA_READ
 	wait_ide_intr();
 #else
 	int i;
-	for (i = 0; i < 512 / sizeof(uint32_t); i ++) {
+	for (i = 0; i < nr * 512 / sizeof(uint32_t); i ++) {
 		*(((uint32_t*)buf) + i) = in_long(IDE_PORT_BASE);
 	}
 #endif
-
 }
 
-void
-disk_do_write(void *buf, uint32_t sector) {
-	int i;
+static void
+disk_write_cmd(void *buf, uint32_t sector, int nr) {
+#ifdef USE_DMA_WRITE
+	dma_prepare(buf, nr * 512);
+
+	clear_ide_intr();
+#endif
 
-	ide_prepare(sector);
+	ide_prepare(sector, nr, DMA_WRITE);
 	issue_write();
 
-	for (i = 0; i < 512 / sizeof(uint32_t); i ++) {
+#ifdef USE_DMA_WRITE
+	/* the buffer can not be reused until the transfer completes */
+	wait_ide_intr();
+#else
+	int i;
+	for (i = 0; i < nr * 512 / sizeof(uint32_t); i ++) {
 		out_long(IDE_PORT_BASE, *(((uint32_t*)buf) + i));
 	}
+#endif
+}
+
+/* Read ``nr'' consecutive sectors starting from ``sector'' into ``buf''.
+ * As many sectors as possible are moved by one command. The paravirtual
+ * block device is preferred if NEMU provides it.
+ */
+void
+disk_do_read_n(void *buf, uint32_t sector, int nr) {
+	if (pvblk_present()) {
+		pvblk_read(buf, sector, nr);
+		return;
+	}
+
+	while (nr > 0) {
+		int n = (nr < MAX_SECTOR_PER_CMD ? nr : MAX_SECTOR_PER_CMD);
+		disk_read_cmd(buf, sector, n);
+		buf += n * 512;
+		sector += n;
+		nr -= n;
+	}
+}
+
+void
+disk_do_write_n(void *buf, uint32_t sector, int nr) {
+	if (pvblk_present()) {
+		pvblk_write(buf, sector, nr);
+		return;
+	}
+
+	while (nr > 0) {
+		int n = (nr < MAX_SECTOR_PER_CMD ? nr : MAX_SECTOR_PER_CMD);
+		disk_write_cmd(buf, sector, n);
+		buf += n * 512;
+		sector += n;
+		nr -= n;
+	}
+}
+
+void
+disk_do_read(void *buf, uint32_t sector) {
+	disk_do_read_n(buf, sector, 1);
+}
+
+void
+disk_do_write(void *buf, uint32_t sector) {
+	disk_do_write_n(buf, sector, 1);
 }
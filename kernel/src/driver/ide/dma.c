@@ -4,32 +4,58 @@
 
 #define BMR_PORT 0xc040
 
-/* TODO: define the PRDT here */
+/* Physical Region Descriptor */
+typedef struct {
+	uint32_t addr;
+	uint16_t byte_cnt;		/* 0 means 64KB */
+	uint16_t eot;			/* bit 15 marks the last entry */
+} PRD;
 
+/* One command moves at most 256 sectors (128KB). Since a region can
+ * not cross a 64KB boundary, such a buffer needs no more than 3 entries.
+ */
+#define NR_PRD 4
 
+static PRD prdt[NR_PRD] __attribute__((aligned(8)));
 
+/* Describe the buffer ``buf'' of ``len'' bytes with the PRDT, splitting
+ * it at 64KB boundaries. The buffer should be physically contiguous,
+ * which is always the case for the kernel memory.
+ *
+ * NOTE: All addresses seen by devices are physical.
+ */
 void
-dma_prepare(void *buf) {
-	/* TODO:
-	 * 1. Prepare a Physical Region Descriptor Table(PRDT)
-	 *		with single entry.
-	 * 2. Fill the PRD entry as following
-	 *		address: the address of ``buf''
-	 *		byte_cnt: 512
-	 *		eot: 1
-	 * 3. Load the address of PRDT to the Descriptor Table
-	 *		Pointer Register(port = BMR_PORT + 4):
-	 *
-	 *			out_long(BMR_PORT + 4, PRDT_addr);
-	 * 
-	 *
-	 * NOTE: All addresses seen by devices are physical.
-	 */
-
-	panic("please implement me");
+dma_prepare(void *buf, uint32_t len) {
+	uint32_t addr = (uint32_t)va_to_pa(buf);
+	int i = 0;
+
+	assert(len > 0);
+	while (len > 0) {
+		assert(i < NR_PRD);
+		uint32_t n = 0x10000 - (addr & 0xffff);
+		if (n > len) {
+			n = len;
+		}
+
+		prdt[i].addr = addr;
+		prdt[i].byte_cnt = n & 0xffff;
+		prdt[i].eot = 0;
+
+		addr += n;
+		len -= n;
+		i ++;
+	}
+	prdt[i - 1].eot = 0x8000;
+
+	out_long(BMR_PORT + 4, (uint32_t)va_to_pa(prdt));
 }
 
 void
 dma_issue_read(void) {
 	out_byte(BMR_PORT, in_byte(BMR_PORT) | 0x1 | 0x8);
 }
+
+void
+dma_issue_write(void) {
+	out_byte(BMR_PORT, (in_byte(BMR_PORT) & ~0x8) | 0x1);
+}
@@ -3,6 +3,8 @@
 
 #define BMR_PORT 0xc040
 
-void dma_prepare(void *);
+void dma_prepare(void *, uint32_t);
+void dma_issue_read(void);
+void dma_issue_write(void);
 
 #endif
@@ -1,40 +1,85 @@
 #include "common.h"
+#include "memory.h"
+#include "irq.h"
 
-#define WRITEBACK_TIME  1  /* writeback buf for every 1 second */
-#define HZ 100
+/* Reads of at least so many whole sectors bypass the sector buffer,
+ * and the data is moved into the buffer of the caller directly. */
+#define DIRECT_MIN_SECTOR 16
 
 void buf_init(void);
-void buf_writeback(void);
-uint8_t read_byte(uint32_t);
-void write_byte(uint32_t, uint8_t);
+void buf_tick(void);
+void buf_read(uint32_t, uint32_t, void *, uint32_t);
+void buf_write(uint32_t, uint32_t, const void *, uint32_t);
+void buf_read_direct(void *, uint32_t, int);
+void *uva_to_kva(void *);
 
 void add_irq_handle(int, void (*)(void));
+void add_irq_handle_prio(int, void (*)(void), int);
+bool frame_idle(void);
+void init_pvblk(void);
 
-/* The kernel is monolithic, therefore we do not need to
- * translate the address ``buf'' from the user process to
- * a physical one, which is necessary for a microkernel.
+/* Read ``nr'' sectors into ``buf'' of the user process. The buffer may be
+ * scattered in the physical memory, so it is split into physically
+ * contiguous parts, each of which is read by one command.
  */
-void ide_read(uint8_t *buf, uint32_t offset, uint32_t len) {
-	uint32_t i;
-	for (i = 0; i < len; i ++) {
-		buf[i] = read_byte(offset + i);
+static void
+ide_read_direct(uint8_t *buf, uint32_t sector, uint32_t nr) {
+	while (nr > 0) {
+		uint8_t *kbuf = uva_to_kva(buf);
+		uint32_t len = PAGE_SIZE - ((uint32_t)buf & PAGE_MASK);
+		while (len < nr * 512 && uva_to_kva(buf + len) == kbuf + len) {
+			len += PAGE_SIZE;
+		}
+
+		uint32_t n = len / 512;
+		if (n == 0) {
+			/* less than one sector before a discontinuity */
+			buf_read(sector, 0, buf, 512);
+			n = 1;
+		} else {
+			if (n > nr) {
+				n = nr;
+			}
+			buf_read_direct(kbuf, sector, n);
+		}
+
+		buf += n * 512;
+		sector += n;
+		nr -= n;
 	}
 }
 
-void ide_write(uint8_t *buf, uint32_t offset, uint32_t len) {
-	uint32_t i;
-	for (i = 0; i < len; i ++) {
-		write_byte(offset + i, buf[i]);
+void ide_read(uint8_t *buf, uint32_t offset, uint32_t len) {
+	while (len > 0) {
+		uint32_t sector = offset >> 9;
+		uint32_t off = offset & 511;
+		uint32_t n;
+
+		if (off == 0 && len >= DIRECT_MIN_SECTOR * 512) {
+			n = len & ~511;
+			ide_read_direct(buf, sector, n >> 9);
+		} else {
+			n = (512 - off < len ? 512 - off : len);
+			buf_read(sector, off, buf, n);
+		}
+
+		buf += n;
+		offset += n;
+		len -= n;
 	}
 }
 
-static void
-ide_writeback(void) {
-	static uint32_t counter = 0;
-	counter ++;
-	if (counter == WRITEBACK_TIME * HZ) {
-		buf_writeback();
-		counter = 0;
+void ide_write(uint8_t *buf, uint32_t offset, uint32_t len) {
+	while (len > 0) {
+		uint32_t sector = offset >> 9;
+		uint32_t off = offset & 511;
+		uint32_t n = (512 - off < len ? 512 - off : len);
+
+		buf_write(sector, off, buf, n);
+
+		buf += n;
+		offset += n;
+		len -= n;
 	}
 }
 
@@ -53,7 +98,10 @@ clear_ide_intr(void) {
 void
 wait_ide_intr(void) {
 	while(has_ide_intr == 0) {
-		wait_intr();
+		/* zero a free frame instead of halting, if there is one to zero */
+		if(!frame_idle()) {
+			wait_intr();
+		}
 	}
 
 	clear_ide_intr();
@@ -61,8 +109,9 @@ wait_ide_intr(void) {
 
 void
 init_ide(void) {
+	init_pvblk();
 	buf_init();
-	add_irq_handle(0, ide_writeback);
-	add_irq_handle(14, ide_intr);
+	add_irq_handle(0, buf_tick);
+	add_irq_handle_prio(14, ide_intr, IRQ_PRIO_DEVICE);
 }
 
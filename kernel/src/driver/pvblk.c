@@ -0,0 +1,135 @@
+#include "common.h"
+#include "memory.h"
+#include "irq.h"
+#include "x86.h"
+#include <string.h>
+
+/* Driver for the paravirtual block device of NEMU. Requests are put
+ * into a ring in the kernel memory, and the device is notified by one
+ * write to the doorbell register, so that many sectors are moved without
+ * any port I/O. See nemu/src/device/pvblk.c for the register map.
+ */
+
+#define PVBLK_ADDR 0x8000000
+#define PVBLK_IRQ 11
+#define PVBLK_MAGIC 0x4b425650
+
+#define PVBLK_CMD_READ 0
+#define PVBLK_CMD_WRITE 1
+
+#define PVBLK_OK 0
+
+#define NR_RING 16
+
+enum { MAGIC, CAPACITY, RING_ADDR, RING_SIZE, DOORBELL, ISR };
+
+typedef struct {
+	uint32_t cmd;
+	uint32_t sector;
+	uint32_t nr_sector;
+	uint32_t addr;
+	uint32_t status;
+	uint32_t pad[3];
+} PVBlkReq;
+
+static struct {
+	volatile uint32_t avail;
+	volatile uint32_t used;
+	uint32_t pad[6];
+	volatile PVBlkReq req[NR_RING];
+} ring __attribute__((aligned(32)));
+
+static volatile uint32_t *reg;
+static bool present = false;
+
+void add_irq_handle_prio(int, void (*)(void), int);
+bool frame_idle(void);
+
+#ifdef IA32_PAGE
+PDE* get_kpdir();
+
+#ifndef IA32_PSE
+static PTE pvblk_ptable[NR_PTE] align_to_page;
+#endif
+
+/* The registers are outside of the physical memory, which is not
+ * covered by the kernel mapping. Map them right after it, in the same
+ * way as the kernel mapping. */
+static volatile uint32_t *
+map_registers(void) {
+	uint32_t va = KOFFSET + PVBLK_ADDR;
+	PDE *kpdir = get_kpdir();
+
+#ifdef IA32_PSE
+	kpdir[va / PT_SIZE].val = make_large_pde(PVBLK_ADDR);
+#else
+	pvblk_ptable[(va / PAGE_SIZE) % NR_PTE].val = make_pte(PVBLK_ADDR);
+	kpdir[va / PT_SIZE].val = make_pde(va_to_pa(pvblk_ptable));
+#endif
+	return (void *)va;
+}
+#else
+static volatile uint32_t *
+map_registers(void) {
+	return (void *)PVBLK_ADDR;
+}
+#endif
+
+static void
+pvblk_intr(void) {
+	/* acknowledge the interrupt, completions are found in the ring */
+	reg[ISR] = 0x1;
+}
+
+bool
+pvblk_present(void) {
+	return present;
+}
+
+static void
+pvblk_do(uint32_t cmd, void *buf, uint32_t sector, uint32_t nr) {
+	volatile PVBlkReq *r = &ring.req[ring.avail % NR_RING];
+	r->cmd = cmd;
+	r->sector = sector;
+	r->nr_sector = nr;
+	r->addr = (uint32_t)va_to_pa(buf);
+	r->status = -1;
+	ring.avail ++;
+
+	/* one doorbell write and one interrupt for the whole request */
+	reg[DOORBELL] = 1;
+	while (ring.used != ring.avail) {
+		/* zero a free frame instead of halting, if there is one to zero */
+		if (!frame_idle()) {
+			wait_intr();
+		}
+	}
+
+	assert(r->status == PVBLK_OK);
+}
+
+/* ``buf'' should be physically contiguous, which holds for the kernel memory. */
+void
+pvblk_read(void *buf, uint32_t sector, uint32_t nr) {
+	pvblk_do(PVBLK_CMD_READ, buf, sector, nr);
+}
+
+void
+pvblk_write(void *buf, uint32_t sector, uint32_t nr) {
+	pvblk_do(PVBLK_CMD_WRITE, buf, sector, nr);
+}
+
+void
+init_pvblk(void) {
+	reg = map_registers();
+	if (reg[MAGIC] != PVBLK_MAGIC) {
+		/* fall back to the IDE disk */
+		return;
+	}
+
+	memset((void *)&ring, 0, sizeof(ring));
+	reg[RING_ADDR] = (uint32_t)va_to_pa(&ring);
+	reg[RING_SIZE] = NR_RING;
+	add_irq_handle_prio(PVBLK_IRQ, pvblk_intr, IRQ_PRIO_DEVICE);
+	present = true;
+}
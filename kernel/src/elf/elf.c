@@ -13,8 +13,86 @@ void ramdisk_read(uint8_t *, uint32_t, uint32_t);
 
 #define STACK_SIZE (1 << 20)
 
+/* the RTC registers of NEMU, see nemu/src/device/rtc.c */
+#define RTC_ADDR 0x8001000
+
 void create_video_mapping();
 uint32_t get_ucr3();
+void* uva_to_kva(void *);
+PTE* uva_to_pte(uint32_t);
+bool mm_fault(uint32_t);
+int mm_map_disk(uint32_t, uint32_t, uint32_t, uint32_t);
+void mm_map(uint32_t, uint32_t);
+
+static void
+read_disk(uint8_t *buf, uint32_t offset, uint32_t len) {
+#ifdef HAS_DEVICE
+	ide_read(buf, offset, len);
+#else
+	ramdisk_read(buf, offset, len);
+#endif
+}
+
+/* Get the kernel address of the page ``va'' of the user process for
+ * copying a segment, since the page directory of the user process is not
+ * loaded yet. A page shared with a mapped segment is filled from the disk
+ * first, so that the part of that segment in it is kept.
+ */
+static uint8_t *
+segment_page(uint32_t va) {
+#ifdef IA32_PAGE
+	PTE *pte = uva_to_pte(va);
+	if((pte == NULL || !pte->present) && !mm_fault(va)) {
+		mm_malloc(va, 1);
+	}
+#endif
+	return uva_to_kva((void *)va);
+}
+
+/* Copy the segment from the disk to the memory region [VirtAddr,
+ * VirtAddr + FileSiz), and zero the region [VirtAddr + FileSiz,
+ * VirtAddr + MemSiz). */
+static void
+copy_segment(Elf32_Phdr *ph) {
+	uint32_t va = ph->p_vaddr;
+	uint32_t file_end = ph->p_vaddr + ph->p_filesz;
+	uint32_t end = ph->p_vaddr + ph->p_memsz;
+
+	while(va < end) {
+		uint32_t n = PAGE_SIZE - (va & PAGE_MASK);
+		if(n > end - va) { n = end - va; }
+
+		uint8_t *p = segment_page(va);
+		uint32_t nr_file = 0;
+		if(va < file_end) {
+			nr_file = (file_end - va < n ? file_end - va : n);
+			read_disk(p, ELF_OFFSET_IN_DISK + ph->p_offset + (va - ph->p_vaddr), nr_file);
+		}
+		memset(p + nr_file, 0, n - nr_file);
+
+		va += n;
+	}
+}
+
+#if defined(IA32_PAGE) && defined(HAS_DEVICE)
+/* Map the segment instead of copying it. Its pages are read from the
+ * sector buffer when the program touches them, and those of the BSS are
+ * zeroed then. The bytes before VirtAddr in the first page come from the
+ * disk as well, therefore the offset of the segment in the file should be
+ * congruent with VirtAddr modulo the page size, which holds for the
+ * usual page-aligned layout. Return false if the segment can not be
+ * mapped, for example when it shares a page with another segment.
+ */
+static bool
+map_segment(Elf32_Phdr *ph) {
+	uint32_t skip = ph->p_vaddr & PAGE_MASK;
+	if((ph->p_offset & PAGE_MASK) != skip) {
+		return false;
+	}
+	return mm_map_disk(ph->p_vaddr - skip, ph->p_memsz + skip,
+			ELF_OFFSET_IN_DISK + ph->p_offset - skip, ph->p_filesz + skip) == 0;
+}
+#endif
 
 uint32_t loader() {
 	Elf32_Ehdr *elf;
@@ -22,34 +100,33 @@ uint32_t loader() {
 
 	uint8_t buf[4096];
 
-#ifdef HAS_DEVICE
-	ide_read(buf, ELF_OFFSET_IN_DISK, 4096);
-#else
-	ramdisk_read(buf, ELF_OFFSET_IN_DISK, 4096);
-#endif
+	read_disk(buf, ELF_OFFSET_IN_DISK, 4096);
 
 	elf = (void*)buf;
 
-	/* TODO: fix the magic number with the correct one */
-	const uint32_t elf_magic = 0xBadC0de;
+	const uint32_t elf_magic = 0x464c457f;
 	uint32_t *p_magic = (void *)buf;
 	nemu_assert(*p_magic == elf_magic);
 
-	/* Load each program segment */
-	panic("please implement me");
-	for(; true; ) {
+	/* the program header table should be in the first 4KB */
+	assert(elf->e_phoff + elf->e_phnum * sizeof(Elf32_Phdr) <= sizeof(buf));
+
+	/* Load each program segment. With paging and the disk, the segments
+	 * are mapped, and only the pages used by the program are ever read.
+	 * Loading then takes no time at all, and the rest of the program is
+	 * brought in while it runs. */
+	int i;
+	ph = (void *)(buf + elf->e_phoff);
+	for(i = 0; i < elf->e_phnum; i ++, ph ++) {
 		/* Scan the program header table, load each segment into memory */
 		if(ph->p_type == PT_LOAD) {
-
-			/* TODO: read the content of the segment from the ELF file 
-			 * to the memory region [VirtAddr, VirtAddr + FileSiz)
-			 */
-			 
-			 
-			/* TODO: zero the memory region 
-			 * [VirtAddr + FileSiz, VirtAddr + MemSiz)
-			 */
-
+			bool mapped = false;
+#if defined(IA32_PAGE) && defined(HAS_DEVICE)
+			mapped = map_segment(ph);
+#endif
+			if(!mapped) {
+				copy_segment(ph);
+			}
 
 #ifdef IA32_PAGE
 			/* Record the program break for future use. */
@@ -63,10 +140,17 @@ uint32_t loader() {
 	volatile uint32_t entry = elf->e_entry;
 
 #ifdef IA32_PAGE
+	/* Unlike the heap, the stack is not faulted in on demand. The user
+	 * program runs in ring 0 without a stack switch, so a fault caused
+	 * by a push would have its trap frame pushed onto the same missing
+	 * page, and end up as a double fault. */
 	mm_malloc(KOFFSET - STACK_SIZE, STACK_SIZE);
 
 #ifdef HAS_DEVICE
 	create_video_mapping();
+
+	/* The user program reads the frequency of rdtsc from the RTC. */
+	mm_map(RTC_ADDR, RTC_ADDR);
 #endif
 
 	write_cr3(get_ucr3());
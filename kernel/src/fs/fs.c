@@ -1,4 +1,5 @@
 #include "common.h"
+#include <string.h>
 
 typedef struct {
 	char *name;
@@ -30,5 +31,171 @@ static const file_info file_table[] __attribute__((used)) = {
 void ide_read(uint8_t *, uint32_t, uint32_t);
 void ide_write(uint8_t *, uint32_t, uint32_t);
 
-/* TODO: implement a simplified file system here. */
+/* Files are found by the hash of their names. The table is built once
+ * at initialization, and holds (index in ``file_table'' + 1), 0 for empty.
+ */
+#define NR_HASH 64
 
+static uint8_t hash_table[NR_HASH];
+
+/* 32-bit FNV-1a */
+static uint32_t
+hash_name(const char *name) {
+	uint32_t h = 2166136261u;
+	for (; *name != '\0'; name ++) {
+		h = (h ^ (uint8_t)*name) * 16777619u;
+	}
+	return h;
+}
+
+/* Only the base name is used, since there are no directories. */
+static const char *
+base_name(const char *pathname) {
+	const char *p = strrchr(pathname, '/');
+	return (p == NULL ? pathname : p + 1);
+}
+
+static int
+lookup(const char *pathname) {
+	const char *name = base_name(pathname);
+	uint32_t h = hash_name(name) % NR_HASH;
+	while (hash_table[h] != 0) {
+		int idx = hash_table[h] - 1;
+		if (strcmp(file_table[idx].name, name) == 0) {
+			return idx;
+		}
+		h = (h + 1) % NR_HASH;
+	}
+	return -1;
+}
+
+void
+init_fs(void) {
+	int i;
+	memset(hash_table, 0, sizeof(hash_table));
+	for (i = 0; i < NR_FILES; i ++) {
+		uint32_t h = hash_name(file_table[i].name) % NR_HASH;
+		while (hash_table[h] != 0) {
+			h = (h + 1) % NR_HASH;
+		}
+		hash_table[h] = i + 1;
+	}
+}
+
+/* The first three file descriptors are stdin, stdout and stderr. */
+#define NR_FD 32
+#define FD_FIRST_FILE 3
+
+typedef struct {
+	bool opened;
+	uint32_t offset;
+	const file_info *file;
+} Fstate;
+
+static Fstate fd_table[NR_FD];
+
+static Fstate *
+get_fstate(int fd) {
+	if (fd < FD_FIRST_FILE || fd >= NR_FD || !fd_table[fd].opened) {
+		return NULL;
+	}
+	return &fd_table[fd];
+}
+
+int
+fs_open(const char *pathname, int flags) {
+	int idx = lookup(pathname);
+	if (idx < 0) {
+		return -1;
+	}
+
+	int fd;
+	for (fd = FD_FIRST_FILE; fd < NR_FD; fd ++) {
+		if (!fd_table[fd].opened) {
+			fd_table[fd].opened = true;
+			fd_table[fd].offset = 0;
+			fd_table[fd].file = &file_table[idx];
+			return fd;
+		}
+	}
+	return -1;
+}
+
+int
+fs_read(int fd, void *buf, int len) {
+	Fstate *f = get_fstate(fd);
+	if (f == NULL || len < 0) {
+		return -1;
+	}
+
+	uint32_t left = f->file->size - f->offset;
+	if (len > left) {
+		len = left;
+	}
+	ide_read(buf, f->file->disk_offset + f->offset, len);
+	f->offset += len;
+	return len;
+}
+
+/* Files have fixed sizes, and writes beyond the end are dropped. */
+int
+fs_write(int fd, const void *buf, int len) {
+	Fstate *f = get_fstate(fd);
+	if (f == NULL || len < 0) {
+		return -1;
+	}
+
+	uint32_t left = f->file->size - f->offset;
+	if (len > left) {
+		len = left;
+	}
+	ide_write((void *)buf, f->file->disk_offset + f->offset, len);
+	f->offset += len;
+	return len;
+}
+
+int
+fs_lseek(int fd, int offset, int whence) {
+	Fstate *f = get_fstate(fd);
+	if (f == NULL) {
+		return -1;
+	}
+
+	int base;
+	switch (whence) {
+		case SEEK_SET: base = 0; break;
+		case SEEK_CUR: base = f->offset; break;
+		case SEEK_END: base = f->file->size; break;
+		default: return -1;
+	}
+
+	int new_offset = base + offset;
+	if (new_offset < 0 || new_offset > f->file->size) {
+		return -1;
+	}
+	f->offset = new_offset;
+	return new_offset;
+}
+
+int
+fs_close(int fd) {
+	Fstate *f = get_fstate(fd);
+	if (f == NULL) {
+		return -1;
+	}
+	f->opened = false;
+	return 0;
+}
+
+
+/* Where the file lies in the disk, for mapping it into memory. */
+int
+fs_extent(int fd, uint32_t *disk_offset, uint32_t *size) {
+	Fstate *f = get_fstate(fd);
+	if (f == NULL) {
+		return -1;
+	}
+	*disk_offset = f->file->disk_offset;
+	*size = f->file->size;
+	return 0;
+}
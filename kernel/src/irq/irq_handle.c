@@ -1,57 +1,187 @@
 #include "irq.h"
 
-#define NR_IRQ_HANDLE 32
-
-/* There are no more than 16(actually, 3) kinds of hardward interrupts. */
-#define NR_HARD_INTR 16
+/* The handlers of each hardware interrupt are kept in an array sorted by
+ * priority, so that dispatching is a plain loop. The time spent in each
+ * handler is accounted in TSC cycles.
+ */
+#define NR_HANDLE_PER_IRQ 8
 
 struct IRQ_t {
 	void (*routine)(void);
-	struct IRQ_t *next;
+	int priority;
+	uint64_t cycles;
 };
 
-static struct IRQ_t handle_pool[NR_IRQ_HANDLE];
-static struct IRQ_t *handles[NR_HARD_INTR];
-static int handle_count = 0;
+static struct IRQ_t handles[NR_HARD_INTR][NR_HANDLE_PER_IRQ];
+static int nr_handle[NR_HARD_INTR];
+
+/* Work deferred by interrupt handlers, such as waiting for the disk, is
+ * done by bottom halves. They run with interrupts enabled when the
+ * outermost trap returns to the user program, and never in the middle
+ * of the kernel.
+ */
+#define NR_BOTTOM_HALF 8
+
+static void (*bottom_halves[NR_BOTTOM_HALF])(void);
+static int nr_bottom_half = 0;
+static volatile uint32_t bh_pending = 0;
+static uint64_t bh_cycles = 0;
+
+/* the number of nested traps being handled */
+static int trap_depth = 0;
+
+/* set when the kernel jumps to the user program */
+static bool in_user = false;
 
 void do_syscall(TrapFrame *);
+void do_page_fault(TrapFrame *);
+
+void
+add_irq_handle_prio(int irq, void (*func)(void), int priority) {
+	assert(irq >= 0 && irq < NR_HARD_INTR);
+	assert(nr_handle[irq] < NR_HANDLE_PER_IRQ);
+
+	/* keep the order of registration among the same priority */
+	struct IRQ_t *h = handles[irq];
+	int i = nr_handle[irq];
+	while (i > 0 && h[i - 1].priority > priority) {
+		h[i] = h[i - 1];
+		i --;
+	}
+	h[i].routine = func;
+	h[i].priority = priority;
+	h[i].cycles = 0;
+	nr_handle[irq] ++;
+}
+
+void
+add_irq_handle(int irq, void (*func)(void)) {
+	add_irq_handle_prio(irq, func, IRQ_PRIO_DEFAULT);
+}
+
+/* Return -1 if ``func'' is not a handler of ``irq''. */
+int
+remove_irq_handle(int irq, void (*func)(void)) {
+	assert(irq >= 0 && irq < NR_HARD_INTR);
+
+	struct IRQ_t *h = handles[irq];
+	int i;
+	for (i = 0; i < nr_handle[irq]; i ++) {
+		if (h[i].routine == func) {
+			for (; i < nr_handle[irq] - 1; i ++) {
+				h[i] = h[i + 1];
+			}
+			nr_handle[irq] --;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* The returned id is passed to raise_bottom_half(). */
+int
+add_bottom_half(void (*func)(void)) {
+	assert(nr_bottom_half < NR_BOTTOM_HALF);
+	bottom_halves[nr_bottom_half] = func;
+	return nr_bottom_half ++;
+}
+
+/* The bottom half runs when the outermost trap returns to the user
+ * program. Therefore it waits while the kernel boots before enter_user(),
+ * and until a long system call is done. Work which must not wait that
+ * long should be done by the caller, or by flush_bottom_halves().
+ */
+void
+raise_bottom_half(int id) {
+	__sync_fetch_and_or(&bh_pending, 1u << id);
+}
 
 void
-add_irq_handle(int irq, void (*func)(void) ) {
-	assert(irq < NR_HARD_INTR);
-	assert(handle_count <= NR_IRQ_HANDLE);
+enter_user(void) {
+	in_user = true;
+}
+
+static void
+run_bottom_halves(void) {
+	uint32_t pending;
+	while ((pending = __sync_lock_test_and_set(&bh_pending, 0)) != 0) {
+		uint64_t start = rdtsc();
+		sti();
+		int i;
+		for (i = 0; i < nr_bottom_half; i ++) {
+			if (pending & (1u << i)) {
+				bottom_halves[i]();
+			}
+		}
+		cli();
+		bh_cycles += rdtsc() - start;
+	}
+}
+
+/* Run the pending bottom halves at once. This is for system calls which
+ * must not return before the deferred work is done, such as sync(), and
+ * does nothing inside a nested trap.
+ */
+void
+flush_bottom_halves(void) {
+	if (trap_depth == 1 && bh_pending != 0) {
+		run_bottom_halves();
+	}
+}
+
+static void
+do_hard_irq(int irq_id) {
+	struct IRQ_t *h = handles[irq_id];
+	int i;
+	for (i = 0; i < nr_handle[irq_id]; i ++) {
+		uint64_t start = rdtsc();
+		h[i].routine();
+		h[i].cycles += rdtsc() - start;
+	}
+}
 
-	struct IRQ_t *ptr;
-	ptr = &handle_pool[handle_count ++]; /* get a free handler */
-	ptr->routine = func;
-	ptr->next = handles[irq]; /* insert into the linked list */
-	handles[irq] = ptr;
+/* Statistics for the time spent in interrupts, in TSC cycles. The cycles
+ * of the i-th handler of ``irq'' in the order they run are at
+ * stat[irq * NR_HANDLE_PER_IRQ + i], and those of the bottom halves
+ * are at stat[NR_HARD_INTR * NR_HANDLE_PER_IRQ].
+ */
+void
+irq_stat(uint64_t *stat) {
+	int irq, i;
+	for (irq = 0; irq < NR_HARD_INTR; irq ++) {
+		for (i = 0; i < NR_HANDLE_PER_IRQ; i ++) {
+			stat[irq * NR_HANDLE_PER_IRQ + i] = (i < nr_handle[irq] ? handles[irq][i].cycles : 0);
+		}
+	}
+	stat[NR_HARD_INTR * NR_HANDLE_PER_IRQ] = bh_cycles;
 }
 
 void irq_handle(TrapFrame *tf) {
 	/* TODO: Re-organize the ``TrapFrame'' structure in `include/irq.h'
-	 * to match the trap frame built during ``do_irq.S''. Remove the 
+	 * to match the trap frame built during ``do_irq.S''. Remove the
 	 * following line after you are done.
 	 */
 	panic("Have you re-organized the ``TrapFrame'' structure?");
 
 	int irq = tf->irq;
 
+	trap_depth ++;
+
 	if (irq < 0) {
 		panic("Unhandled exception!");
 	} else if (irq == 0x80) {
 		do_syscall(tf);
-	} else if (irq < 1000) {
+	} else if (irq == 14) {
+		do_page_fault(tf);
+	} else if (irq >= IRQ_VECTOR_BASE && irq < IRQ_VECTOR_BASE + NR_HARD_INTR) {
+		do_hard_irq(irq - IRQ_VECTOR_BASE);
+	} else {
 		panic("Unexpected exception #%d at eip = %x", irq, tf->eip);
-	} else if (irq >= 1000) {
-		int irq_id = irq - 1000;
-		assert(irq_id < NR_HARD_INTR);
-		struct IRQ_t *f = handles[irq_id];
-
-		while (f != NULL) { /* call handlers one by one */
-			f->routine(); 
-			f = f->next;
-		}
 	}
-}
 
+	if (trap_depth == 1 && in_user && bh_pending != 0) {
+		run_bottom_halves();
+	}
+
+	trap_depth --;
+}
@@ -1,8 +1,18 @@
 #include "common.h"
+#include "memory.h"
 #include "x86.h"
 
 #define SERIAL_PORT  0x3F8
 
+/* the transmitter FIFO of the UART */
+#define FIFO_LEN 16
+
+/* the paravirtual port of NEMU to output a whole buffer in one I/O */
+#define SERIAL_PV_PORT  0x5F0
+#define SERIAL_PV_MAGIC 0x4c525350
+
+static bool has_pv_port = false;
+
 void
 init_serial(void) {
 	out_byte(SERIAL_PORT + 1, 0x00);
@@ -12,6 +22,8 @@ init_serial(void) {
 	out_byte(SERIAL_PORT + 3, 0x03);
 	out_byte(SERIAL_PORT + 2, 0xC7);
 	out_byte(SERIAL_PORT + 4, 0x0B);
+
+	has_pv_port = (in_long(SERIAL_PV_PORT + 8) == SERIAL_PV_MAGIC);
 }
 
 static inline int
@@ -24,3 +36,23 @@ serial_printc(char ch) {
 	while (!serial_idle());
 	out_byte(SERIAL_PORT, ch);
 }
+
+/* Output ``len'' bytes of ``buf''. The buffer should be in the kernel
+ * memory, since its physical address is passed to the device. */
+void
+serial_write(const char *buf, int len) {
+	if (has_pv_port) {
+		out_long(SERIAL_PV_PORT, (uint32_t)va_to_pa(buf));
+		out_long(SERIAL_PV_PORT + 4, len);
+		return;
+	}
+
+	/* The FIFO is empty when the line is idle, so we can fill it up. */
+	int i;
+	for (i = 0; i < len; i ++) {
+		if (i % FIFO_LEN == 0) {
+			while (!serial_idle());
+		}
+		out_byte(SERIAL_PORT, buf[i]);
+	}
+}
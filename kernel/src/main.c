@@ -4,11 +4,13 @@
 void init_page();
 void init_serial();
 void init_ide();
+void init_fs();
 void init_i8259();
 void init_segment();
 void init_idt();
 void init_mm();
 uint32_t loader();
+void enter_user(void);
 
 void video_mapping_write_test();
 void video_mapping_read_test();
@@ -58,6 +60,9 @@ void init_cond() {
 	/* Initialize the IDE driver. */
 	init_ide();
 
+	/* Build the lookup table of the file system. */
+	init_fs();
+
 	/* Enable interrupts. */
 	sti();
 #endif
@@ -91,6 +96,9 @@ void init_cond() {
 	video_mapping_clear();
 #endif
 
+	/* From now on, bottom halves may run when interrupts return. */
+	enter_user();
+
 #ifdef IA32_PAGE
 	/* Set the %esp for user program, which is one of the
 	 * convention of the "advanced" runtime environment. */
@@ -0,0 +1,185 @@
+#include "common.h"
+#include "memory.h"
+#include <string.h>
+
+/* The allocator of physical frames for user processes, a buddy system over
+ * the physical memory above the loader, [KMEM, PHY_MEM). A free block of
+ * 2^order frames is on the free list of its order, and is identified by its
+ * first frame. Blocks are split when allocated and merged with their free
+ * buddies when freed, therefore both take at most MAX_ORDER steps.
+ *
+ * Frames are numbered by their physical addresses. The list links are kept
+ * out of the frames, so that a free frame is never touched until it is
+ * allocated.
+ */
+
+#define FRAME_BASE (KMEM / PAGE_SIZE)
+#define NR_FRAME   (PHY_MEM / PAGE_SIZE)
+
+/* the largest block is 2^MAX_ORDER frames, 4MB */
+#define MAX_ORDER 10
+
+#define NIL 0xffff
+
+static uint16_t free_head[MAX_ORDER + 1];
+static uint16_t next[NR_FRAME], prev[NR_FRAME];
+static uint8_t order_of[NR_FRAME];
+
+/* the first frames of free blocks */
+static uint32_t free_map[NR_FRAME / 32];
+
+static uint32_t nr_free_block[MAX_ORDER + 1];
+static uint32_t nr_free_frame;
+
+/* Frames which are already zeroed. The pool is refilled when the kernel
+ * would otherwise halt, so that demand-zero pages cost no time at the
+ * page fault.
+ */
+#define NR_ZERO_POOL 64
+
+static uint16_t zero_pool[NR_ZERO_POOL];
+static int nr_zero = 0;
+
+/* The disk drivers may call frame_idle() before init_frame(), and
+ * without IA32_PAGE the allocator is never initialized. */
+static bool frame_ready = false;
+
+static inline bool
+is_free_head(uint32_t f, int order) {
+	return (free_map[f / 32] & (1u << (f % 32))) && order_of[f] == order;
+}
+
+static void
+list_add(uint32_t f, int order) {
+	next[f] = free_head[order];
+	prev[f] = NIL;
+	if (free_head[order] != NIL) {
+		prev[free_head[order]] = f;
+	}
+	free_head[order] = f;
+
+	order_of[f] = order;
+	free_map[f / 32] |= 1u << (f % 32);
+	nr_free_block[order] ++;
+	nr_free_frame += 1 << order;
+}
+
+static void
+list_del(uint32_t f, int order) {
+	if (prev[f] != NIL) {
+		next[prev[f]] = next[f];
+	} else {
+		free_head[order] = next[f];
+	}
+	if (next[f] != NIL) {
+		prev[next[f]] = prev[f];
+	}
+
+	free_map[f / 32] &= ~(1u << (f % 32));
+	nr_free_block[order] --;
+	nr_free_frame -= 1 << order;
+}
+
+/* Allocate 2^order contiguous frames. The physical address of
+ * the first one is returned, or 0 if there is no such block.
+ */
+uint32_t
+frame_alloc(int order) {
+	assert(order >= 0 && order <= MAX_ORDER);
+
+	int o = order;
+	while (o <= MAX_ORDER && free_head[o] == NIL) {
+		o ++;
+	}
+	if (o > MAX_ORDER) {
+		return 0;
+	}
+
+	uint32_t f = free_head[o];
+	list_del(f, o);
+
+	/* give back the upper halves */
+	while (o > order) {
+		o --;
+		list_add(f + (1 << o), o);
+	}
+
+	return f * PAGE_SIZE;
+}
+
+void
+frame_free(uint32_t pa, int order) {
+	uint32_t f = pa / PAGE_SIZE;
+	assert(f >= FRAME_BASE && f < NR_FRAME && (f & ((1 << order) - 1)) == 0);
+
+	while (order < MAX_ORDER) {
+		uint32_t buddy = f ^ (1 << order);
+		if (buddy < FRAME_BASE || buddy >= NR_FRAME || !is_free_head(buddy, order)) {
+			break;
+		}
+		list_del(buddy, order);
+		f &= ~(1 << order);
+		order ++;
+	}
+
+	list_add(f, order);
+}
+
+/* Allocate a frame filled with zero. */
+uint32_t
+frame_alloc_zeroed(void) {
+	if (nr_zero > 0) {
+		return zero_pool[-- nr_zero] * PAGE_SIZE;
+	}
+
+	uint32_t pa = frame_alloc(0);
+	if (pa != 0) {
+		memset(pa_to_va(pa), 0, PAGE_SIZE);
+	}
+	return pa;
+}
+
+/* Do some work for the time when the kernel has nothing else to do.
+ * Return false if there is no work, and the kernel can halt.
+ */
+bool
+frame_idle(void) {
+	if (!frame_ready || nr_zero == NR_ZERO_POOL) {
+		return false;
+	}
+
+	uint32_t pa = frame_alloc(0);
+	if (pa == 0) {
+		return false;
+	}
+	memset(pa_to_va(pa), 0, PAGE_SIZE);
+	zero_pool[nr_zero ++] = pa / PAGE_SIZE;
+	return true;
+}
+
+/* Statistics for the fragmentation of the physical memory: the number of
+ * free frames, the number of zeroed frames in the pool, and the number of
+ * free blocks of each order, from 0 to MAX_ORDER. The frames in the pool
+ * are not counted as free.
+ */
+void
+frame_stat(uint32_t *stat) {
+	stat[0] = nr_free_frame;
+	stat[1] = nr_zero;
+	memcpy(stat + 2, nr_free_block, sizeof(nr_free_block));
+}
+
+void
+init_frame(void) {
+	memset(free_head, 0xff, sizeof(free_head));
+	memset(free_map, 0, sizeof(free_map));
+	memset(nr_free_block, 0, sizeof(nr_free_block));
+	nr_free_frame = 0;
+	nr_zero = 0;
+
+	uint32_t f;
+	for (f = FRAME_BASE; f < NR_FRAME; f += 1 << MAX_ORDER) {
+		list_add(f, MAX_ORDER);
+	}
+	frame_ready = true;
+}
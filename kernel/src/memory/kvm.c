@@ -4,7 +4,9 @@
 #include <string.h>
 
 static PDE kpdir[NR_PDE] align_to_page;						// kernel page directory
+#ifndef IA32_PSE
 static PTE kptable[PHY_MEM / PAGE_SIZE] align_to_page;		// kernel page tables
+#endif
 
 PDE* get_kpdir() { return kpdir; }
 
@@ -13,12 +15,29 @@ void init_page(void) {
 	CR0 cr0;
 	CR3 cr3;
 	PDE *pdir = (PDE *)va_to_pa(kpdir);
-	PTE *ptable = (PTE *)va_to_pa(kptable);
 	uint32_t pdir_idx;
 
 	/* make all PDEs invalid */
 	memset(pdir, 0, NR_PDE * sizeof(PDE));
 
+#ifdef IA32_PSE
+	CR4 cr4;
+
+	/* fill PDEs, each of which maps 4MB of the physical memory directly,
+	 * therefore no page tables are needed for the kernel, and one TLB
+	 * entry covers 4MB */
+	for (pdir_idx = 0; pdir_idx < PHY_MEM / PT_SIZE; pdir_idx ++) {
+		pdir[pdir_idx].val = make_large_pde(pdir_idx * PT_SIZE);
+		pdir[pdir_idx + KOFFSET / PT_SIZE].val = make_large_pde(pdir_idx * PT_SIZE);
+	}
+
+	/* enable 4MB pages */
+	cr4.val = read_cr4();
+	cr4.page_size_extensions = 1;
+	write_cr4(cr4.val);
+#else
+	PTE *ptable = (PTE *)va_to_pa(kptable);
+
 	/* fill PDEs */
 	for (pdir_idx = 0; pdir_idx < PHY_MEM / PT_SIZE; pdir_idx ++) {
 		pdir[pdir_idx].val = make_pde(ptable);
@@ -52,16 +71,18 @@ void init_page(void) {
 			ptable --;
 		}
 	*/
-
+#endif
 
 	/* make CR3 to be the entry of page directory */
 	cr3.val = 0;
 	cr3.page_directory_base = ((uint32_t)pdir) >> 12;
 	write_cr3(cr3.val);
 
-	/* set PG bit in CR0 to enable paging */
+	/* set PG bit in CR0 to enable paging, and WP bit to make read-only
+	 * pages hold also for the user program, which runs in ring 0 */
 	cr0.val = read_cr0();
 	cr0.paging = 1;
+	cr0.write_protect = 1;
 	write_cr0(cr0.val);
 }
 
@@ -1,5 +1,6 @@
 #include "common.h"
 #include "memory.h"
+#include "irq.h"
 #include <string.h>
 
 static PDE updir[NR_PDE] align_to_page;
@@ -10,25 +11,127 @@ uint32_t get_ucr3() { return ucr3.val; }
 
 PDE* get_kpdir();
 
+/* Find the PTE which maps the address ``va'' in the user process.
+ * NULL is returned if there is no page table for it.
+ */
+PTE* uva_to_pte(uint32_t va) {
+	PDE *pde = &updir[va / PT_SIZE];
+	if (!pde->present) {
+		return NULL;
+	}
+	PTE *ptable = pa_to_va(pde->page_frame << 12);
+	return &ptable[(va / PAGE_SIZE) % NR_PTE];
+}
+
+bool mm_fault(uint32_t);
+uint32_t frame_alloc_zeroed(void);
+void mm_map(uint32_t, uint32_t);
+void init_frame(void);
+
+/* Translate the address ``va'' in the user process to the kernel virtual
+ * address of the same physical memory. Devices can then be given its
+ * physical address with va_to_pa(). A page which is not present yet is
+ * faulted in, as if the user process had touched it.
+ */
+void* uva_to_kva(void *va) {
+#ifdef IA32_PAGE
+	uint32_t addr = (uint32_t)va;
+	if (addr >= KOFFSET) {
+		return va;
+	}
+
+	PTE *pte = uva_to_pte(addr);
+	if (pte == NULL || !pte->present) {
+		bool ok = mm_fault(addr);
+		assert(ok);
+		pte = uva_to_pte(addr);
+	}
+	return pa_to_va((pte->page_frame << 12) | (addr & PAGE_MASK));
+#else
+	return va;
+#endif
+}
+
 uint32_t brk = 0;
 
-/* The brk() system call handler. */
+/* the initial program break set by the loader, 0 before the first brk() */
+static uint32_t heap_start = 0;
+
+/* The brk() system call handler. Only the range of the heap is recorded,
+ * and its pages are allocated when they are touched for the first time.
+ * Therefore a program does not pay for the heap it never uses.
+ */
 void mm_brk(uint32_t new_brk) {
-	if(new_brk > brk) {
-		mm_malloc(brk, new_brk - brk);
+	if(heap_start == 0) {
+		heap_start = brk;
+	}
+	if(new_brk < brk && new_brk >= heap_start) {
+		/* free the pages wholly above the new break, but not the
+		 * last page of the program, which the loader has mapped */
+		uint32_t start = (new_brk + PAGE_MASK) & ~PAGE_MASK;
+		uint32_t first_heap_page = (heap_start & ~PAGE_MASK) + PAGE_SIZE;
+		if(start < first_heap_page) {
+			start = first_heap_page;
+		}
+		if(start < brk) {
+			mm_free(start, brk - start);
+		}
 	}
 	brk = new_brk;
 }
 
+static bool
+anon_fault(uint32_t addr) {
+	if(heap_start == 0 || addr < heap_start || addr >= brk) {
+		return false;
+	}
+
+	uint32_t pa = frame_alloc_zeroed();
+	assert(pa != 0);
+	mm_map(addr & ~PAGE_MASK, pa);
+	return true;
+}
+
+bool mmap_fault(uint32_t);
+bool mmap_contains(uint32_t);
+
+/* Make the page containing ``addr'' present. Return false if ``addr''
+ * is not in any area of the user process.
+ */
+bool mm_fault(uint32_t addr) {
+	/* The mappings come first, since the last page of the program,
+	 * which may be mapped by the loader, holds the start of the heap. */
+	return mmap_fault(addr) || anon_fault(addr);
+}
+
+/* The page fault handler. The faulting address is in CR2. */
+void do_page_fault(TrapFrame *tf) {
+	uint32_t addr = read_cr2();
+	if (!(tf->eflags & FL_IF) && !(tf->error_code & 0x1) && mmap_contains(addr)) {
+		/* a page not present is read from the disk, whose
+		 * interrupt could never arrive */
+		panic("Page fault at address %x needs the disk with interrupts disabled, eip = %x",
+				addr, tf->eip);
+	}
+	if (mm_fault(addr)) {
+		return;
+	}
+	panic("Page fault at address %x, eip = %x, error code = %x",
+			addr, tf->eip, tf->error_code);
+}
+
 void init_mm() {
 	PDE *kpdir = get_kpdir();
 
+	init_frame();
+
 	/* make all PDE invalid */
 	memset(updir, 0, NR_PDE * sizeof(PDE));
 
-	/* create the same mapping above 0xc0000000 as the kernel mapping does */
+	/* create the same mapping above 0xc0000000 as the kernel mapping does,
+	 * including the device registers mapped after the physical memory */
 	memcpy(&updir[KOFFSET / PT_SIZE], &kpdir[KOFFSET / PT_SIZE], 
-			(PHY_MEM / PT_SIZE) * sizeof(PDE));
+			(NR_PDE - KOFFSET / PT_SIZE) * sizeof(PDE));
 
 	ucr3.val = (uint32_t)va_to_pa((uint32_t)updir) & ~0xfff;
 }
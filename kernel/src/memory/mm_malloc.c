@@ -0,0 +1,72 @@
+#include "common.h"
+#include "memory.h"
+#include <string.h>
+
+PDE* get_updir();
+PTE* uva_to_pte(uint32_t);
+
+uint32_t frame_alloc(int);
+void frame_free(uint32_t, int);
+uint32_t frame_alloc_zeroed(void);
+
+/* Map the page ``va'' of the user process to the frame ``pa''. The page
+ * table is allocated if it does not exist. The page should not be present.
+ */
+void
+mm_map(uint32_t va, uint32_t pa) {
+	PDE *pde = &get_updir()[va / PT_SIZE];
+	if (!pde->present) {
+		uint32_t ptable = frame_alloc_zeroed();
+		assert(ptable != 0);
+		pde->val = make_pde(ptable);
+	}
+
+	PTE *pte = uva_to_pte(va);
+	assert(!pte->present);
+	pte->val = make_pte(pa);
+}
+
+/* Allocate frames for the pages in [va, va + len) of the user process
+ * which are not present. The physical address of ``va'' is returned.
+ * The frames are not zeroed.
+ */
+uint32_t
+mm_malloc(uint32_t va, int len) {
+	if (len <= 0) {
+		return 0;
+	}
+
+	uint32_t last = va + len - 1;
+	uint32_t page;
+	for (page = va & ~PAGE_MASK; page <= last; page += PAGE_SIZE) {
+		PTE *pte = uva_to_pte(page);
+		if (pte == NULL || !pte->present) {
+			uint32_t pa = frame_alloc(0);
+			assert(pa != 0);
+			mm_map(page, pa);
+		}
+	}
+
+	PTE *pte = uva_to_pte(va);
+	return (pte->page_frame << 12) | (va & PAGE_MASK);
+}
+
+/* Unmap the pages in [va, va + len) of the user process, and free
+ * their frames. The page tables are kept.
+ */
+void
+mm_free(uint32_t va, int len) {
+	if (len <= 0) {
+		return;
+	}
+
+	uint32_t page;
+	for (page = va & ~PAGE_MASK; page < va + len; page += PAGE_SIZE) {
+		PTE *pte = uva_to_pte(page);
+		if (pte != NULL && pte->present) {
+			frame_free(pte->page_frame << 12, 0);
+			pte->val = make_invalid_pte();
+			invlpg(page);
+		}
+	}
+}
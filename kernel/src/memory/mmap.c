@@ -0,0 +1,203 @@
+#include "common.h"
+#include "memory.h"
+#include <string.h>
+
+/* Mappings of the disk in the user process: files mapped by mmap(), and
+ * the segments of the program mapped by the loader. Nothing is read when
+ * a mapping is made. Each page is filled from the sector buffer when it is
+ * touched for the first time, so that only the parts of a large file which
+ * are really used cost memory and disk traffic. Every page is a private
+ * copy, and writes to it never reach the disk. Therefore mmap() only
+ * makes read-only mappings, and only the loader makes writable ones.
+ */
+
+/* the range of virtual addresses for mappings, between the heap and the stack */
+#define MMAP_BASE  0x80000000
+#define MMAP_LIMIT 0xbf000000
+
+#define NR_MMAP 16
+
+/* the same values as GNU/Linux */
+#define PROT_WRITE  0x2
+#define MAP_SHARED  0x1
+
+typedef struct {
+	bool used;
+	uint32_t start, end;		/* [start, end), aligned to pages */
+	uint32_t disk_offset;		/* where ``start'' is in the disk */
+	uint32_t size;				/* bytes of the file from ``start'', the rest reads as zero */
+	bool writable;
+} MMap;
+
+static MMap mmap_table[NR_MMAP];
+
+/* the end of the highest mapping */
+static uint32_t mmap_top = MMAP_BASE;
+
+int fs_extent(int, uint32_t *, uint32_t *);
+void ide_read(uint8_t *, uint32_t, uint32_t);
+uint32_t frame_alloc(int);
+void mm_map(uint32_t, uint32_t);
+PTE* uva_to_pte(uint32_t);
+
+static MMap *
+find_mmap(uint32_t addr) {
+	int i;
+	for (i = 0; i < NR_MMAP; i ++) {
+		if (mmap_table[i].used && addr >= mmap_table[i].start && addr < mmap_table[i].end) {
+			return &mmap_table[i];
+		}
+	}
+	return NULL;
+}
+
+static MMap *
+add_mmap(uint32_t start, uint32_t end, uint32_t disk_offset, uint32_t size, bool writable) {
+	int i;
+	for (i = 0; i < NR_MMAP; i ++) {
+		if (!mmap_table[i].used) {
+			MMap *m = &mmap_table[i];
+			m->used = true;
+			m->start = start;
+			m->end = end;
+			m->disk_offset = disk_offset;
+			m->size = (size < end - start ? size : end - start);
+			m->writable = writable;
+			return m;
+		}
+	}
+	return NULL;
+}
+
+/* Map ``len'' bytes of the file ``fd'' from ``offset'', which should be
+ * aligned to pages. Writable or shared mappings are refused, since writes
+ * would never reach the file. The address of the mapping is returned, or
+ * -1 on failure, as MAP_FAILED.
+ */
+uint32_t
+mm_mmap(uint32_t len, int prot, int flags, int fd, uint32_t offset) {
+	uint32_t disk_offset, size;
+	if ((prot & PROT_WRITE) || (flags & MAP_SHARED)) {
+		return -1;
+	}
+	if (len == 0 || (offset & PAGE_MASK) || fs_extent(fd, &disk_offset, &size) != 0 || offset > size) {
+		return -1;
+	}
+
+	len = (len + PAGE_MASK) & ~PAGE_MASK;
+	if (len > MMAP_LIMIT - mmap_top) {
+		return -1;
+	}
+
+	MMap *m = add_mmap(mmap_top, mmap_top + len, disk_offset + offset, size - offset, false);
+	if (m == NULL) {
+		return -1;
+	}
+	mmap_top = m->end;
+	return m->start;
+}
+
+/* Map ``size'' bytes of the disk from ``disk_offset'' at ``va'' of the
+ * user process, followed by zero up to ``va + len''. ``va'' should be
+ * aligned to pages. This is used by the loader for program segments.
+ * Return -1 if the range overlaps an existing mapping.
+ */
+int
+mm_map_disk(uint32_t va, uint32_t len, uint32_t disk_offset, uint32_t size) {
+	uint32_t end = (va + len + PAGE_MASK) & ~PAGE_MASK;
+	int i;
+	for (i = 0; i < NR_MMAP; i ++) {
+		if (mmap_table[i].used && va < mmap_table[i].end && end > mmap_table[i].start) {
+			return -1;
+		}
+	}
+	return (add_mmap(va, end, disk_offset, size, true) == NULL ? -1 : 0);
+}
+
+/* Only whole mappings can be unmapped. */
+int
+mm_munmap(uint32_t addr) {
+	MMap *m = find_mmap(addr);
+	if (m == NULL || m->start != addr) {
+		return -1;
+	}
+
+	mm_free(m->start, m->end - m->start);
+
+	m->used = false;
+	if (m->end == mmap_top) {
+		/* give back the address space, and that below it which
+		 * is no longer used by any mapping */
+		mmap_top = MMAP_BASE;
+		int i;
+		for (i = 0; i < NR_MMAP; i ++) {
+			if (mmap_table[i].used && mmap_table[i].end > mmap_top) {
+				mmap_top = mmap_table[i].end;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Return whether a fault at ``addr'' would read the disk. */
+bool
+mmap_contains(uint32_t addr) {
+	return find_mmap(addr) != NULL;
+}
+
+/* Called by the page fault handler. Return whether ``addr'' is in a
+ * mapping, in which case the page is filled and mapped. A write to a
+ * present read-only page is not handled.
+ */
+bool
+mmap_fault(uint32_t addr) {
+	MMap *m = find_mmap(addr);
+	if (m == NULL) {
+		return false;
+	}
+
+	uint32_t page = addr & ~PAGE_MASK;
+	PTE *pte = uva_to_pte(page);
+	if (pte != NULL && pte->present) {
+		return false;
+	}
+
+	uint32_t pa = frame_alloc(0);
+	assert(pa != 0);
+	mm_map(page, pa);
+	if (!m->writable) {
+		pte = uva_to_pte(page);
+		pte->read_write = 0;
+	}
+	uint8_t *kva = pa_to_va(pa);
+
+	/* Consecutive pages are usually touched in turn, and the read-ahead
+	 * of the sector buffer makes the following faults cheap. */
+	uint32_t off = page - m->start;
+	uint32_t len = 0;
+	if (off < m->size) {
+		len = (m->size - off < PAGE_SIZE ? m->size - off : PAGE_SIZE);
+		ide_read(kva, m->disk_offset + off, len);
+	}
+	memset(kva + len, 0, PAGE_SIZE - len);
+	return true;
+}
+
+/* Fill all pages of the program segments mapped by the loader, which
+ * are the writable mappings. Interrupt handlers of the user program run
+ * with IF clear, and a fault there can not wait for the disk, so this is
+ * done before the program registers any of them.
+ */
+void
+mmap_populate(void) {
+	int i;
+	for (i = 0; i < NR_MMAP; i ++) {
+		MMap *m = &mmap_table[i];
+		if (m->used && m->writable) {
+			uint32_t page;
+			for (page = m->start; page < m->end; page += PAGE_SIZE) {
+				mmap_fault(page);
+			}
+		}
+	}
+}
@@ -1,9 +1,32 @@
 #include "irq.h"
 
 #include <sys/syscall.h>
+#include <string.h>
 
 void add_irq_handle(int, void (*)(void));
 void mm_brk(uint32_t);
+void buf_stat(uint32_t *);
+void frame_stat(uint32_t *);
+void irq_stat(uint64_t *);
+void buf_writeback(void);
+void flush_bottom_halves(void);
+void mmap_populate(void);
+void serial_write(const char *, int);
+
+int fs_open(const char *, int);
+int fs_read(int, void *, int);
+int fs_write(int, const void *, int);
+int fs_lseek(int, int, int);
+int fs_close(int);
+
+uint32_t mm_mmap(uint32_t, int, int, int, uint32_t);
+int mm_munmap(uint32_t);
+
+/* Artificial system calls for debugging. Their numbers are far
+ * beyond those of GNU/Linux to avoid conflicts. */
+#define SYS_buf_stat 0x1000
+#define SYS_frame_stat 0x1001
+#define SYS_irq_stat 0x1002
 
 static void sys_brk(TrapFrame *tf) {
 #ifdef IA32_PAGE
@@ -12,6 +35,41 @@ static void sys_brk(TrapFrame *tf) {
 	tf->eax = 0;
 }
 
+/* The old mmap() of i386, whose arguments are passed in memory:
+ * addr, len, prot, flags, fd, offset. Only read-only private mappings
+ * of files are supported, others fail, and the address hint is ignored.
+ */
+static void sys_mmap(TrapFrame *tf) {
+#ifdef IA32_PAGE
+	uint32_t *args = (void *)tf->ebx;
+	tf->eax = mm_mmap(args[1], args[2], args[3], args[4], args[5]);
+#else
+	tf->eax = -1;
+#endif
+}
+
+static void sys_write(TrapFrame *tf) {
+	int fd = tf->ebx;
+	const char *buf = (void *)tf->ecx;
+	int len = tf->edx;
+
+	if (fd == 1 || fd == 2) {
+		/* The serial port takes physical addresses, so the data
+		 * of the user process is copied into the kernel first. */
+		static char kbuf[256];
+		int i;
+		for (i = 0; i < len; i += sizeof(kbuf)) {
+			int n = (len - i < sizeof(kbuf) ? len - i : sizeof(kbuf));
+			memcpy(kbuf, buf + i, n);
+			serial_write(kbuf, n);
+		}
+		tf->eax = len;
+	}
+	else {
+		tf->eax = fs_write(fd, buf, len);
+	}
+}
+
 void do_syscall(TrapFrame *tf) {
 	switch(tf->eax) {
 		/* The ``add_irq_handle'' system call is artificial. We use it to 
@@ -20,12 +78,29 @@ void do_syscall(TrapFrame *tf) {
 		 * system call never exists in GNU/Linux.
 		 */
 		case 0: 
+#ifdef IA32_PAGE
+			/* the handler must not fault on a page of the program */
+			mmap_populate();
+#endif
 			cli();
 			add_irq_handle(tf->ebx, (void*)tf->ecx);
 			sti();
 			break;
 
 		case SYS_brk: sys_brk(tf); break;
+		case SYS_sync: flush_bottom_halves(); buf_writeback(); tf->eax = 0; break;
+
+		case SYS_open: tf->eax = fs_open((void *)tf->ebx, tf->ecx); break;
+		case SYS_read: tf->eax = fs_read(tf->ebx, (void *)tf->ecx, tf->edx); break;
+		case SYS_write: sys_write(tf); break;
+		case SYS_lseek: tf->eax = fs_lseek(tf->ebx, tf->ecx, tf->edx); break;
+		case SYS_close: tf->eax = fs_close(tf->ebx); break;
+		case SYS_mmap: sys_mmap(tf); break;
+		case SYS_munmap: tf->eax = mm_munmap(tf->ebx); break;
+
+		case SYS_buf_stat: buf_stat((void *)tf->ebx); tf->eax = 0; break;
+		case SYS_frame_stat: frame_stat((void *)tf->ebx); tf->eax = 0; break;
+		case SYS_irq_stat: irq_stat((void *)tf->ebx); tf->eax = 0; break;
 
 		/* TODO: Add more system calls. */
 
@@ -6,6 +6,10 @@
 /* You will define this macro in PA4 */
 //#define HAS_DEVICE
 
+/* Define this macro to run the devices without SDL. Frames are
+ * hashed and optionally dumped to PNG files instead of displayed. */
+//#define HEADLESS
+
 #define DEBUG
 #define LOG_FILE
 
@@ -29,6 +29,8 @@ typedef struct {
 	};
 
 	swaddr_t eip;
+
+	bool INTR;		/* the interrupt line from the i8259 */
 } CPU_state;
 
 extern CPU_state cpu;
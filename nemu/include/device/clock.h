@@ -0,0 +1,32 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include "common.h"
+
+/* NEMU keeps a virtual clock which is driven by the number of executed
+ * instructions instead of the host time. Therefore the guest sees the
+ * same timing no matter how fast the host is.
+ * You can modify this value to make the virtual CPU faster or slower.
+ */
+#define INSTR_PER_SEC (10 * 1000 * 1000)
+
+#define INSTR_PER_HZ(hz) (INSTR_PER_SEC / (hz))
+#define US_TO_INSTR(us) ((uint64_t)(us) * (INSTR_PER_SEC / 1000000))
+#define INSTR_TO_NS(n) ((uint64_t)(n) * (1000000000 / INSTR_PER_SEC))
+
+/* the number of instructions executed since NEMU started */
+extern uint64_t vclock;
+
+/* the exact virtual time, even in the middle of cpu_exec() */
+uint64_t vclock_now();
+
+/* the virtual time of the earliest pending device event, cpu_exec()
+ * will run straight until this deadline before calling device_update() */
+extern uint64_t clock_deadline;
+
+/* the virtual time at which the running chunk of cpu_exec() ends, -1 when
+ * the CPU is not running. An event added with an earlier deadline makes
+ * cpu_exec() cut the chunk short. */
+extern uint64_t chunk_end;
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __DISK_H__
+#define __DISK_H__
+
+#include "common.h"
+
+/* the size of the disk image in bytes */
+extern size_t disk_size;
+
+void disk_read(void *, uint32_t, size_t);
+void disk_write(uint32_t, const void *, size_t);
+
+#endif
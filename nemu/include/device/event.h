@@ -0,0 +1,26 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include "common.h"
+#include "device/clock.h"
+
+/* A device event is a callback which should be fired at some future
+ * virtual time. All pending events are kept in a priority queue, and
+ * ``clock_deadline'' always holds the virtual time of the earliest one.
+ */
+typedef struct {
+	uint64_t deadline;
+	void (*callback)(void);
+	int heap_idx;		/* -1 if the event is not pending */
+} Event;
+
+void init_event(Event *, void (*)(void));
+void event_add(Event *, uint64_t);
+void event_cancel(Event *);
+void event_run();
+
+static inline bool event_pending(Event *e) {
+	return e->heap_idx >= 0;
+}
+
+#endif
@@ -3,10 +3,31 @@
 
 #include "common.h"
 
+#define MMIO_PAGE_SHIFT 12
+
 typedef void(*mmio_callback_t)(hwaddr_t, size_t, bool);
 
+typedef struct {
+	hwaddr_t low;
+	hwaddr_t high;
+	uint8_t *mmio_space;
+	mmio_callback_t callback;
+} MMIO_t;
+
+extern MMIO_t mmio_maps[];
+extern uint8_t mmio_page_table[];
+
 void* add_mmio_map(hwaddr_t, size_t, mmio_callback_t);
-int is_mmio(hwaddr_t);
+
+/* bus interface */
+static inline int is_mmio(hwaddr_t addr) {
+	/* Most accesses go to RAM, which costs only one table lookup. */
+	int map_NO = mmio_page_table[addr >> MMIO_PAGE_SHIFT] - 1;
+	if(map_NO >= 0 && addr >= mmio_maps[map_NO].low && addr <= mmio_maps[map_NO].high) {
+		return map_NO;
+	}
+	return -1;
+}
 
 uint32_t mmio_read(hwaddr_t, size_t, int);
 void mmio_write(hwaddr_t, size_t, uint32_t, int);
@@ -1,7 +1,22 @@
 #ifndef __MONITOR_H__
 #define __MONITOR_H__
 
+#include "common.h"
+
 enum { STOP, RUNNING, END };
 extern int nemu_state;
 
+/* Reasons for cpu_exec() to leave the instruction loop early. This word
+ * is the only thing checked after each instruction. It is set atomically,
+ * therefore it is safe to request an exit from other threads. This does
+ * not hold for the device state, e.g. the i8259, which is only touched
+ * on the CPU thread.
+ */
+enum { EXIT_REQ_STOP = 0x1, EXIT_REQ_INTR = 0x2, EXIT_REQ_EVENT = 0x4 };
+extern uint32_t exit_request;
+
+static inline void cpu_exit_request(uint32_t reason) {
+	__atomic_or_fetch(&exit_request, reason, __ATOMIC_RELEASE);
+}
+
 #endif
@@ -173,7 +173,7 @@ helper_fun _2byte_opcode_table [256] = {
 /* 0x24 */	inv, inv, inv, inv,
 /* 0x28 */	inv, inv, inv, inv, 
 /* 0x2c */	inv, inv, inv, inv, 
-/* 0x30 */	inv, inv, inv, inv, 
+/* 0x30 */	inv, rdtsc, inv, inv, 
 /* 0x34 */	inv, inv, inv, inv,
 /* 0x38 */	inv, inv, inv, inv, 
 /* 0x3c */	inv, inv, inv, inv, 
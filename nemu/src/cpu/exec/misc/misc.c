@@ -1,5 +1,6 @@
 #include "cpu/exec/helper.h"
 #include "cpu/decode/modrm.h"
+#include "device/clock.h"
 
 make_helper(nop) {
 	print_asm("nop");
@@ -23,3 +24,14 @@ make_helper(lea) {
 	print_asm("leal %s,%%%s", op_src->str, regsl[m.reg]);
 	return 1 + len;
 }
+
+/* The time-stamp counter is the virtual clock, which ticks
+ * INSTR_PER_SEC times per second. */
+make_helper(rdtsc) {
+	uint64_t tsc = vclock_now();
+	cpu.eax = (uint32_t)tsc;
+	cpu.edx = tsc >> 32;
+
+	print_asm("rdtsc");
+	return 1;
+}
@@ -4,5 +4,6 @@
 make_helper(nop);
 make_helper(int3);
 make_helper(lea);
+make_helper(rdtsc);
 
 #endif
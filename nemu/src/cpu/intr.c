@@ -0,0 +1,10 @@
+#include "nemu.h"
+
+/* Deliver the interrupt or exception ``NO'' to the guest. */
+void raise_intr(uint8_t NO) {
+	/* TODO: Trigger an interrupt/exception with ``NO''.
+	 * That is, use ``NO'' to index the IDT, push EFLAGS, CS and
+	 * EIP, and jump to the handler in the gate.
+	 */
+	panic("please implement raise_intr() to deliver interrupt #%d", NO);
+}
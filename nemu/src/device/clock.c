@@ -0,0 +1,5 @@
+#include "device/clock.h"
+
+uint64_t vclock = 0;
+uint64_t clock_deadline = -1;
+uint64_t chunk_end = -1;
@@ -1,18 +1,35 @@
 #include "common.h"
 #ifdef HAS_DEVICE
 
+#include "device/event.h"
+
 void init_serial();
 void init_timer();
+void init_rtc();
 void init_vga();
 void init_i8042();
+void init_key_script();
+void init_disk();
 void init_ide();
+void init_pvblk();
 
 void init_device() {
 	init_serial();
 	init_timer();
+	init_rtc();
 	init_vga();
 	init_i8042();
+	init_key_script();
+	init_disk();
 	init_ide();
+	init_pvblk();
+}
+
+/* This function is called by cpu_exec() when the virtual clock
+ * reaches ``clock_deadline''. It fires all the events due.
+ */
+void device_update() {
+	event_run();
 }
 
 #endif
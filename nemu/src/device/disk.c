@@ -0,0 +1,55 @@
+#include "common.h"
+#include "device/disk.h"
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The disk image is mapped into the address space of NEMU, so data
+ * transfers are just memory copies without any system call. By default
+ * the mapping is shared and writes reach the image file. If the
+ * environment variable NEMU_DISK_OVERLAY is set, the image is opened
+ * read-only and mapped privately, so that writes are kept in memory and
+ * many instances of NEMU can share one image.
+ */
+static uint8_t *disk;
+size_t disk_size;
+
+/* read ``len'' bytes from the disk, bytes beyond the end of the disk are zero */
+void disk_read(void *buf, uint32_t offset, size_t len) {
+	size_t n = 0;
+	if(offset < disk_size) {
+		n = (len < disk_size - offset ? len : disk_size - offset);
+		memcpy(buf, disk + offset, n);
+	}
+	memset(buf + n, 0, len - n);
+}
+
+/* Writes should be within the disk. The offset comes from the guest, so
+ * the disk controllers check it, and report an error to the guest. */
+void disk_write(uint32_t offset, const void *buf, size_t len) {
+	Assert(offset + len <= disk_size, "write beyond the end of disk (offset = %u)", offset);
+	memcpy(disk + offset, buf, len);
+}
+
+/* The disk image is shared by all disk controllers. */
+void init_disk() {
+	extern char *exec_file;
+	bool overlay = (getenv("NEMU_DISK_OVERLAY") != NULL);
+	int fd = open(exec_file, overlay ? O_RDONLY : O_RDWR);
+	Assert(fd >= 0, "Can not open '%s'", exec_file);
+
+	struct stat st;
+	int ret = fstat(fd, &st);
+	assert(ret == 0);
+	disk_size = st.st_size;
+
+	disk = mmap(NULL, disk_size, PROT_READ | PROT_WRITE,
+			overlay ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+	Assert(disk != MAP_FAILED, "Can not map '%s'", exec_file);
+
+	/* The mapping is still valid after the file is closed. */
+	close(fd);
+}
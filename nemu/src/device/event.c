@@ -0,0 +1,97 @@
+#include "device/event.h"
+#include "monitor/monitor.h"
+
+#define NR_EVENT 32
+
+/* a binary min-heap ordered by deadline */
+static Event *heap[NR_EVENT];
+static int nr_event = 0;
+
+static void heap_set(int idx, Event *e) {
+	heap[idx] = e;
+	e->heap_idx = idx;
+}
+
+static void sift_up(int idx) {
+	Event *e = heap[idx];
+	while(idx > 0) {
+		int parent = (idx - 1) / 2;
+		if(heap[parent]->deadline <= e->deadline) { break; }
+		heap_set(idx, heap[parent]);
+		idx = parent;
+	}
+	heap_set(idx, e);
+}
+
+static void sift_down(int idx) {
+	Event *e = heap[idx];
+	while(true) {
+		int child = 2 * idx + 1;
+		if(child >= nr_event) { break; }
+		if(child + 1 < nr_event && heap[child + 1]->deadline < heap[child]->deadline) {
+			child ++;
+		}
+		if(e->deadline <= heap[child]->deadline) { break; }
+		heap_set(idx, heap[child]);
+		idx = child;
+	}
+	heap_set(idx, e);
+}
+
+static void update_deadline() {
+	clock_deadline = (nr_event > 0 ? heap[0]->deadline : -1);
+	if(clock_deadline < chunk_end) {
+		/* the running chunk would overshoot the new deadline */
+		cpu_exit_request(EXIT_REQ_EVENT);
+	}
+}
+
+/* device interface */
+void init_event(Event *e, void (*callback)(void)) {
+	e->callback = callback;
+	e->heap_idx = -1;
+}
+
+/* Fire the event ``delay'' instructions later than the exact current
+ * time, even in the middle of cpu_exec(). If the event is already
+ * pending, it is rescheduled.
+ */
+void event_add(Event *e, uint64_t delay) {
+	if(event_pending(e)) {
+		event_cancel(e);
+	}
+
+	assert(nr_event < NR_EVENT);
+	e->deadline = vclock_now() + delay;
+	heap_set(nr_event, e);
+	nr_event ++;
+	sift_up(e->heap_idx);
+	update_deadline();
+}
+
+void event_cancel(Event *e) {
+	if(!event_pending(e)) {
+		return;
+	}
+
+	int idx = e->heap_idx;
+	e->heap_idx = -1;
+	nr_event --;
+	if(idx != nr_event) {
+		Event *last = heap[nr_event];
+		heap_set(idx, last);
+		sift_down(idx);
+		sift_up(last->heap_idx);
+	}
+	update_deadline();
+}
+
+/* CPU interface */
+void event_run() {
+	while(nr_event > 0 && heap[0]->deadline <= vclock) {
+		Event *e = heap[0];
+		event_cancel(e);
+		/* The callback may add the event again. */
+		e->callback();
+	}
+}
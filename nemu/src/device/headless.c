@@ -0,0 +1,200 @@
+#include "common.h"
+
+#if defined(HAS_DEVICE) && defined(HEADLESS)
+
+#include "vga.h"
+#include "device/clock.h"
+
+#include <stdlib.h>
+
+/* The headless counterpart of sdl.c. Nothing is displayed, and the guest
+ * runs as fast as possible. Each frame presented is hashed, so that the
+ * output of graphic programs can be checked against golden hashes.
+ *
+ * The hashes are written to FRAME_HASH_FILE, one line per frame. Set the
+ * environment variable NEMU_DUMP_FRAMES to a comma-separated list of
+ * frame numbers (e.g. "1,100,250") to dump these frames to PNG files.
+ */
+
+#define FRAME_HASH_FILE "frame-hash.txt"
+#define FRAME_PNG_FILE "frame-%05d.png"
+#define NR_DUMP_MAX 64
+
+static FILE *hash_fp;
+static int frame_no = 0;
+
+static int dump_list[NR_DUMP_MAX];
+static int nr_dump = 0;
+
+/* 64-bit FNV-1a */
+static uint64_t hash_frame(Frame *f) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	const uint8_t *p = (void *)f->vmem;
+	int i;
+	for(i = 0; i < sizeof(f->vmem); i ++) {
+		h = (h ^ p[i]) * 0x100000001b3ull;
+	}
+	for(i = 0; i < 256; i ++) {
+		h = (h ^ f->palette[i].r) * 0x100000001b3ull;
+		h = (h ^ f->palette[i].g) * 0x100000001b3ull;
+		h = (h ^ f->palette[i].b) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+/* ===== a minimal PNG writer with uncompressed deflate blocks ===== */
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *buf, size_t len) {
+	static uint32_t table[256];
+	if(table[1] == 0) {
+		uint32_t i, k;
+		for(i = 0; i < 256; i ++) {
+			uint32_t c = i;
+			for(k = 0; k < 8; k ++) {
+				c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+	}
+
+	crc = ~crc;
+	while(len --) {
+		crc = table[(crc ^ *buf ++) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static uint8_t* put_be32(uint8_t *p, uint32_t val) {
+	p[0] = val >> 24; p[1] = val >> 16; p[2] = val >> 8; p[3] = val;
+	return p + 4;
+}
+
+static void write_chunk(FILE *fp, const char *type, const uint8_t *data, uint32_t len) {
+	uint8_t head[8];
+	put_be32(head, len);
+	memcpy(head + 4, type, 4);
+	uint32_t crc = crc32_update(0, head + 4, 4);
+	crc = crc32_update(crc, data, len);
+
+	uint8_t tail[4];
+	put_be32(tail, crc);
+	fwrite(head, 8, 1, fp);
+	fwrite(data, len, 1, fp);
+	fwrite(tail, 4, 1, fp);
+}
+
+static void dump_png(Frame *f, const char *filename) {
+	/* each line is led by a filter byte */
+	const uint32_t line_len = 1 + CTR_COL * 3;
+	const uint32_t raw_len = CTR_ROW * line_len;
+	uint8_t *raw = malloc(raw_len);
+	assert(raw);
+
+	int i, j;
+	uint8_t *p = raw;
+	for(i = 0; i < CTR_ROW; i ++) {
+		*p ++ = 0;
+		for(j = 0; j < CTR_COL; j ++) {
+			Color c = f->palette[ f->vmem[i][j] ];
+			*p ++ = c.r; *p ++ = c.g; *p ++ = c.b;
+		}
+	}
+
+	/* zlib stream: header, stored blocks of at most 65535 bytes, adler32 */
+	const uint32_t max_block = 65535;
+	uint32_t nr_block = (raw_len + max_block - 1) / max_block;
+	uint8_t *idat = malloc(2 + raw_len + 5 * nr_block + 4);
+	assert(idat);
+
+	uint8_t *q = idat;
+	*q ++ = 0x78; *q ++ = 0x01;
+
+	uint32_t a = 1, b = 0, off;
+	for(off = 0; off < raw_len; off ++) {
+		a = (a + raw[off]) % 65521;
+		b = (b + a) % 65521;
+	}
+
+	for(off = 0; off < raw_len; off += max_block) {
+		uint16_t len = (raw_len - off < max_block ? raw_len - off : max_block);
+		*q ++ = (off + len == raw_len);		/* BFINAL, BTYPE = 00 */
+		*q ++ = len; *q ++ = len >> 8;
+		*q ++ = ~len; *q ++ = (uint16_t)~len >> 8;
+		memcpy(q, raw + off, len);
+		q += len;
+	}
+	q = put_be32(q, (b << 16) | a);
+
+	uint8_t ihdr[13];
+	put_be32(ihdr, CTR_COL);
+	put_be32(ihdr + 4, CTR_ROW);
+	ihdr[8] = 8;		/* bit depth */
+	ihdr[9] = 2;		/* color type: RGB */
+	ihdr[10] = ihdr[11] = ihdr[12] = 0;
+
+	FILE *fp = fopen(filename, "wb");
+	Assert(fp, "Can not open '%s'", filename);
+	fwrite("\x89PNG\r\n\x1a\n", 8, 1, fp);
+	write_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+	write_chunk(fp, "IDAT", idat, q - idat);
+	write_chunk(fp, "IEND", NULL, 0);
+	fclose(fp);
+
+	free(idat);
+	free(raw);
+}
+
+static bool should_dump(int no) {
+	int i;
+	for(i = 0; i < nr_dump; i ++) {
+		if(dump_list[i] == no) { return true; }
+	}
+	return false;
+}
+
+/* Called by the refresh of the VGA right after a frame is published, so
+ * that the frame presented is always the one of this refresh. A frame is
+ * presented when any line of it changes.
+ */
+void headless_present() {
+	uint32_t dirty[NR_DIRTY_WORD];
+	Frame *f = vga_take_frame(dirty);
+
+	int i;
+	bool changed = false;
+	for(i = 0; i < NR_DIRTY_WORD; i ++) {
+		if(dirty[i]) { changed = true; }
+	}
+
+	if(changed) {
+		frame_no ++;
+		fprintf(hash_fp, "frame %d at %llu: %016llx\n", frame_no,
+				(unsigned long long)vclock, (unsigned long long)hash_frame(f));
+
+		if(should_dump(frame_no)) {
+			char filename[32];
+			sprintf(filename, FRAME_PNG_FILE, frame_no);
+			dump_png(f, filename);
+		}
+	}
+}
+
+void sdl_clear_event_queue() {
+}
+
+/* The same interface as sdl.c, therefore the callers need not care
+ * about which display backend is used. */
+void init_sdl() {
+	hash_fp = fopen(FRAME_HASH_FILE, "w");
+	Assert(hash_fp, "Can not open '%s'", FRAME_HASH_FILE);
+	setvbuf(hash_fp, NULL, _IOLBF, 0);
+
+	char *list = getenv("NEMU_DUMP_FRAMES");
+	while(list != NULL && *list != '\0' && nr_dump < NR_DUMP_MAX) {
+		char *end;
+		dump_list[nr_dump ++] = strtol(list, &end, 10);
+		list = (*end == ',' ? end + 1 : NULL);
+	}
+}
+
+#endif	/* HAS_DEVICE && HEADLESS */
@@ -1,5 +1,6 @@
 #include "common.h"
 #include "cpu/reg.h"
+#include "monitor/monitor.h"
 
 #define IRQ_BASE 32
 #define NO_INTR -1
@@ -39,11 +40,7 @@ static const char ffo_table[] = {
 static void do_i8259() {
 	int8_t master_irq = master.highest_irq;
 	if(master_irq == NO_INTR) {
-		/* TODO: Uncomment the following line after the ``INTR'' member
-		 * is added to the CPU_state structure.
-		 */
-		// cpu.INTR = false;
-		panic("uncomment the line above");
+		cpu.INTR = false;
 		return;
 	}
 	else if(master_irq == 2) {
@@ -52,14 +49,18 @@ static void do_i8259() {
 	}
 
 	intr_NO = master_irq + IRQ_BASE;
-	/* TODO: Uncomment the following line after the ``INTR'' member
-	 * is added to the CPU_state structure.
-	 */
-	// cpu.INTR = true;
-	panic("uncomment the line above");
+	cpu.INTR = true;
+
+	/* Let the CPU leave the instruction loop to check the interrupt. */
+	cpu_exit_request(EXIT_REQ_INTR);
 }
 
-/* device interface */
+/* device interface
+ * The state of the i8259 is updated with plain read-modify-writes, so all
+ * functions here must be called on the CPU thread: from I/O handlers and
+ * device events. A host thread which finishes some work, such as the DMA
+ * worker, leaves the interrupt to an event fired on the CPU thread.
+ */
 void i8259_raise_intr(int n) {
 	assert(n >= 0 && n < 16);
 	if(n < 8) {
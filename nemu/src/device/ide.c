@@ -2,6 +2,10 @@
 #include "memory/memory.h"
 #include "device/port-io.h"
 #include "device/i8259.h"
+#include "device/event.h"
+#include "device/disk.h"
+
+#include <pthread.h>
 
 #define IDE_CTRL_PORT 0x3F6
 #define IDE_PORT 0x1F0
@@ -9,26 +13,58 @@
 
 #define IDE_IRQ 14
 
+/* modelled latency of a disk command (seek and rotation),
+ * and the time to transfer one sector */
+#define IDE_CMD_LATENCY_US 100
+#define IDE_SECTOR_LATENCY_US 5
+
 static uint8_t *ide_port_base;
 static uint8_t *bmr_base;	/* bus master registers */
 
 static uint32_t sector, disk_idx;
+static uint32_t nr_sector;
 static uint32_t byte_cnt;
 static bool ide_write;
-static FILE *disk_fp;
+
+/* PIO and DMA commands complete by separate events, so that a command
+ * issued in the middle of a DMA transfer can not lose its completion. */
+static Event ide_event, dma_event;
+
+/* the modelled time for a command of ``nr_sector'' sectors */
+static uint64_t ide_latency(int nr_sector) {
+	return US_TO_INSTR(IDE_CMD_LATENCY_US + nr_sector * IDE_SECTOR_LATENCY_US);
+}
+
+static void ide_finish() {
+	ide_port_base[7] = 0x40;
+	i8259_raise_intr(IDE_IRQ);
+}
+
+/* the LBA address and the sector count of the current command */
+static void ide_load_sector() {
+	sector = (ide_port_base[6] & 0x1f) << 24 | ide_port_base[5] << 16
+		| ide_port_base[4] << 8 | ide_port_base[3];
+	disk_idx = sector << 9;
+
+	/* a sector count of 0 means 256 sectors */
+	nr_sector = (ide_port_base[2] == 0 ? 256 : ide_port_base[2]);
+	byte_cnt = 0;
+}
 
 void ide_io_handler(ioaddr_t addr, size_t len, bool is_write) {
-	assert(byte_cnt <= 512);
-	int ret;
+	assert(byte_cnt <= nr_sector * 512);
 	if(is_write) {
 		if(addr - IDE_PORT == 0 && len == 4) {
-			/* write 4 bytes data to disk */
+			/* write 4 bytes data to disk, data beyond the end
+			 * of the disk is dropped */
 			assert(ide_write);
-			ret = fwrite(ide_port_base, 4, 1, disk_fp);
-			assert(ret == 1);
+			if((uint64_t)sector * 512 + byte_cnt + 4 <= disk_size) {
+				disk_write(disk_idx, ide_port_base, 4);
+			}
+			disk_idx += 4;
 
 			byte_cnt += 4;
-			if(byte_cnt == 512) {
+			if(byte_cnt == nr_sector * 512) {
 				/* finish */
 				ide_port_base[7] = 0x40;
 			}
@@ -36,28 +72,27 @@ void ide_io_handler(ioaddr_t addr, size_t len, bool is_write) {
 		else if(addr - IDE_PORT == 7) {
 			if(ide_port_base[7] == 0x20 || ide_port_base[7] == 0x30) {
 				/* command: read/write */
-				sector = (ide_port_base[6] & 0x1f) << 24 | ide_port_base[5] << 16
-					| ide_port_base[4] << 8 | ide_port_base[3];
-				disk_idx = sector << 9;
-				fseek(disk_fp, disk_idx, SEEK_SET);
-
-				byte_cnt = 0;
+				ide_load_sector();
 
 				if(ide_port_base[7] == 0x20) {
 					/* command: read from disk */
 					ide_write = false;
 					ide_port_base[7] = 0x40;
-					i8259_raise_intr(IDE_IRQ);
+
+					/* The data is ready at once, but the interrupt
+					 * is raised when the command completes. */
+					event_add(&ide_event, ide_latency(nr_sector));
 				}
 				else {
 					/* command: write to disk */
 					ide_write = true;
 				}
 			}
-			else if (ide_port_base[7] == 0xc8) {
-				/* command: DMA read */
+			else if (ide_port_base[7] == 0xc8 || ide_port_base[7] == 0xca) {
+				/* command: DMA read/write */
+				ide_load_sector();
 
-				/* Nothing to do here. The actual read operation is
+				/* Nothing else to do here. The actual transfer is
 				 * issued by write commands to the bus master register. */
 			}
 			else {
@@ -70,11 +105,11 @@ void ide_io_handler(ioaddr_t addr, size_t len, bool is_write) {
 		if(addr - IDE_PORT == 0 && len == 4) {
 			/* read 4 bytes data from disk */
 			assert(!ide_write);
-			ret = fread(ide_port_base, 4, 1, disk_fp);
-			assert(ret == 1 || feof(disk_fp));
+			disk_read(ide_port_base, disk_idx, 4);
+			disk_idx += 4;
 
 			byte_cnt += 4;
-			if(byte_cnt == 512) {
+			if(byte_cnt == nr_sector * 512) {
 				/* finish */
 				ide_port_base[7] = 0x40;
 			}
@@ -82,41 +117,153 @@ void ide_io_handler(ioaddr_t addr, size_t len, bool is_write) {
 	}
 }
 
-void bmr_io_handler(ioaddr_t addr, size_t len, bool is_write) {
-	int ret;
-	if(is_write) {
-		if(addr - BMR_PORT == 0) {
-			if(bmr_base[0] & 0x1) {
-				/* DMA start command */
-				if(bmr_base[0] & 0x8) {
-					/* DMA read */
+/* A PRDT can not cross a 64KB boundary, so it holds at most 8192 entries. */
+#define NR_PRD_MAX 8192
+#define PRD_EOT 0x80000000
 
-					/* the address of Physical Region Descriptor Table */
-					hwaddr_t prdt_addr = *(uint32_t *)(bmr_base + 4);
+/* DMA transfers are done by a host worker thread, so the guest keeps
+ * running while the data is being moved. The completion interrupt is
+ * still raised at the modelled latency, and the CPU thread waits for
+ * the worker at that time if it is not finished yet. Therefore the
+ * timing seen by the guest does not depend on the speed of the host.
+ */
+typedef struct {
+	uint8_t *addr;
+	uint32_t len;
+} DMARegion;
 
-					hwaddr_t addr = hwaddr_read(prdt_addr, 4);
-					uint32_t hi_entry = hwaddr_read(prdt_addr + 4, 4);
-					uint16_t byte_cnt = hi_entry & 0xffff;
+static struct {
+	DMARegion region[NR_PRD_MAX];
+	int nr_region;
+	uint32_t offset;
+	bool write;
+	bool error;		/* the PRDT is too small for the command */
+} dma_req;
 
-					sector = (ide_port_base[6] & 0x1f) << 24 | ide_port_base[5] << 16
-						| ide_port_base[4] << 8 | ide_port_base[3];
-					disk_idx = sector << 9;
-					fseek(disk_fp, disk_idx, SEEK_SET);
+static enum { DMA_IDLE, DMA_QUEUED, DMA_DONE } dma_state = DMA_IDLE;
+static pthread_mutex_t dma_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dma_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t dma_thread;
 
-					ret = fread((void *)hwa_to_va(addr), byte_cnt, 1, disk_fp);
-					assert(ret == 1 || feof(disk_fp));
+/* worker thread */
+static void* dma_worker(void *arg) {
+	while(true) {
+		pthread_mutex_lock(&dma_lock);
+		while(dma_state != DMA_QUEUED) {
+			pthread_cond_wait(&dma_cond, &dma_lock);
+		}
+		pthread_mutex_unlock(&dma_lock);
 
-					/* We only implement PRDT of single entry. */
-					assert(hi_entry & 0x80000000);
+		int i;
+		uint32_t offset = dma_req.offset;
+		for(i = 0; i < dma_req.nr_region; i ++) {
+			DMARegion *r = &dma_req.region[i];
+			if(dma_req.write) {
+				disk_write(offset, r->addr, r->len);
+			}
+			else {
+				disk_read(r->addr, offset, r->len);
+			}
+			offset += r->len;
+		}
 
-					/* finish */
-					ide_port_base[7] = 0x40;
-					i8259_raise_intr(IDE_IRQ);
-				}
-				else {
-					/* DMA write is not implemented */
-					assert(0);
+		pthread_mutex_lock(&dma_lock);
+		dma_state = DMA_DONE;
+		pthread_cond_broadcast(&dma_cond);
+		pthread_mutex_unlock(&dma_lock);
+	}
+	return NULL;
+}
+
+/* Walk the Physical Region Descriptor Table and queue the transfer of
+ * the whole command to the worker. Each entry describes a region of
+ * ``byte_cnt'' bytes (0 means 64KB), and the entry with the EOT bit set
+ * is the last one. Return false without doing anything if the previous
+ * transfer is not finished yet.
+ */
+static bool dma_start(bool write) {
+	hwaddr_t prdt_addr = *(uint32_t *)(bmr_base + 4);
+	uint32_t remain = nr_sector * 512;
+	int i;
+
+	if(event_pending(&dma_event)) {
+		/* the previous transfer is still in flight */
+		return false;
+	}
+
+	ide_write = write;
+	dma_req.nr_region = 0;
+	dma_req.error = false;
+	for(i = 0; i < NR_PRD_MAX && remain > 0; i ++) {
+		hwaddr_t addr = hwaddr_read(prdt_addr + i * 8, 4);
+		uint32_t hi_entry = hwaddr_read(prdt_addr + i * 8 + 4, 4);
+		uint32_t len = hi_entry & 0xffff;
+		if(len == 0) { len = 0x10000; }
+		if(len > remain) { len = remain; }
+
+		if(addr >= HW_MEM_SIZE || len > HW_MEM_SIZE - addr) {
+			/* the buffer is outside of the physical memory */
+			dma_req.error = true;
+			break;
+		}
+		dma_req.region[i].addr = hwa_to_va(addr);
+		dma_req.region[i].len = len;
+		dma_req.nr_region ++;
+		remain -= len;
+
+		if(hi_entry & PRD_EOT) { break; }
+	}
+	if(write && (uint64_t)sector * 512 + nr_sector * 512 > disk_size) {
+		/* the command writes beyond the end of the disk, nothing is written */
+		dma_req.nr_region = 0;
+		dma_req.error = true;
+	}
+	dma_req.offset = disk_idx;
+	dma_req.write = ide_write;
+	dma_req.error |= (remain > 0);
+	disk_idx += nr_sector * 512 - remain;
+
+	pthread_mutex_lock(&dma_lock);
+	dma_state = DMA_QUEUED;
+	pthread_cond_broadcast(&dma_cond);
+	pthread_mutex_unlock(&dma_lock);
+	return true;
+}
+
+/* called by the CPU thread when the command completes */
+static void dma_finish() {
+	pthread_mutex_lock(&dma_lock);
+	while(dma_state != DMA_DONE) {
+		pthread_cond_wait(&dma_cond, &dma_lock);
+	}
+	dma_state = DMA_IDLE;
+	pthread_mutex_unlock(&dma_lock);
+
+	/* clear the active bit and set the interrupt bit of the status register,
+	 * the error bit is set if the PRDT does not cover the command, or
+	 * the command writes beyond the end of the disk */
+	bmr_base[2] = (bmr_base[2] & ~0x1) | 0x4 | (dma_req.error ? 0x2 : 0);
+	ide_finish();
+}
+
+void bmr_io_handler(ioaddr_t addr, size_t len, bool is_write) {
+	if(is_write) {
+		if(addr - BMR_PORT == 0) {
+			if(bmr_base[0] & 0x1) {
+				/* DMA start command, bit 3 selects the direction:
+				 * set for reading from disk, clear for writing to disk */
+				if(!dma_start(!(bmr_base[0] & 0x8))) {
+					/* a start while busy is ignored, and reported
+					 * by the error bit of the status register */
+					bmr_base[2] |= 0x2;
+					return;
 				}
+
+				/* The data is moved by the worker in the background,
+				 * and the command completes at the modelled latency. */
+				ide_port_base[7] = 0x80;	/* busy */
+				bmr_base[2] = (bmr_base[2] & ~0x2) | 0x1;
+				event_add(&dma_event, ide_latency(nr_sector));
 			}
 		}
 	}
@@ -125,11 +272,14 @@ void bmr_io_handler(ioaddr_t addr, size_t len, bool is_write) {
 void init_ide() {
 	ide_port_base = add_pio_map(IDE_PORT, 8, ide_io_handler);
 	ide_port_base[7] = 0x40;
+	nr_sector = 1;
 
 	bmr_base = add_pio_map(BMR_PORT, 8, bmr_io_handler);
 	bmr_base[0] = 0;
 
-	extern char *exec_file;
-	disk_fp = fopen(exec_file, "r+");
-	Assert(disk_fp, "Can not open '%s'", exec_file);
+	init_event(&ide_event, ide_finish);
+	init_event(&dma_event, dma_finish);
+
+	int ret = pthread_create(&dma_thread, NULL, dma_worker, NULL);
+	Assert(ret == 0, "Can not create the DMA worker thread");
 }
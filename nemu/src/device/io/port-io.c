@@ -2,7 +2,10 @@
 #include "device/port-io.h"
 
 #define PORT_IO_SPACE_MAX 65536
-#define NR_MAP 8
+
+/* The map number is stored in one byte of ``pio_table'',
+ * and 0 is reserved for ports without device. */
+#define NR_MAP 255
 
 /* "+ 3" is for hacking, see pio_read() below */
 static uint8_t pio_space[PORT_IO_SPACE_MAX + 3];
@@ -16,13 +19,13 @@ typedef struct {
 static PIO_t maps[NR_MAP];
 static int nr_map = 0;
 
+/* port -> (map number + 1), 0 for ports without device */
+static uint8_t pio_table[PORT_IO_SPACE_MAX];
+
 static void pio_callback(ioaddr_t addr, size_t len, bool is_write) {
-	int i;
-	for(i = 0; i < nr_map; i ++) {
-		if(addr >= maps[i].low && addr + len - 1 <= maps[i].high) {
-			maps[i].callback(addr, len, is_write);
-			return;
-		}
+	int map_NO = pio_table[addr] - 1;
+	if(map_NO >= 0 && addr + len - 1 <= maps[map_NO].high) {
+		maps[map_NO].callback(addr, len, is_write);
 	}
 }
 
@@ -33,6 +36,14 @@ void* add_pio_map(ioaddr_t addr, size_t len, pio_callback_t callback) {
 	maps[nr_map].low = addr;
 	maps[nr_map].high = addr + len - 1;
 	maps[nr_map].callback = callback;
+
+	int i;
+	for(i = 0; i < len; i ++) {
+		/* Two maps can not share a port. */
+		assert(pio_table[addr + i] == 0);
+		pio_table[addr + i] = nr_map + 1;
+	}
+
 	nr_map ++;
 	return pio_space + addr;
 }
@@ -53,4 +64,3 @@ void pio_write(ioaddr_t addr, size_t len, uint32_t data) {
 	memcpy(pio_space + addr, &data, len);
 	pio_callback(addr, len, true);
 }
-
@@ -0,0 +1,93 @@
+#include "common.h"
+#include "device/event.h"
+
+#include <stdlib.h>
+
+/* Replay keyboard input from a script, so that programs can be driven
+ * through a fixed scenario without anyone at the keyboard. The script
+ * is given by the environment variable NEMU_KEY_SCRIPT. Each line is
+ *
+ *   <vclock> <scancode> down|up
+ *
+ * where <vclock> is the virtual time (the number of instructions, as
+ * printed in frame-hash.txt) to press or release the key, and <scancode>
+ * is the make code, e.g. 0x1e for 'A'. Lines should be sorted by time.
+ * Empty lines and lines starting with '#' are ignored.
+ */
+
+typedef struct {
+	uint64_t time;
+	uint8_t scancode;
+} KeyRecord;
+
+static KeyRecord *record;
+static int nr_record = 0;
+static int next = 0;
+
+static Event script_event;
+
+void keyboard_intr(uint8_t);
+
+static void schedule_next() {
+	if(next < nr_record) {
+		uint64_t time = record[next].time;
+		event_add(&script_event, (time > vclock ? time - vclock : 0));
+	}
+}
+
+static void replay() {
+	while(next < nr_record && record[next].time <= vclock) {
+		keyboard_intr(record[next].scancode);
+		next ++;
+	}
+	schedule_next();
+}
+
+static void load_script(const char *filename) {
+	FILE *fp = fopen(filename, "r");
+	Assert(fp, "Can not open '%s'", filename);
+
+	int max_record = 64;
+	record = malloc(max_record * sizeof(KeyRecord));
+	assert(record);
+
+	char line[128];
+	int line_no = 0;
+	while(fgets(line, sizeof(line), fp)) {
+		line_no ++;
+		char *p = line;
+		while(*p == ' ' || *p == '\t') { p ++; }
+		if(*p == '#' || *p == '\n' || *p == '\0') { continue; }
+
+		unsigned long long time;
+		unsigned int scancode;
+		char action[8];
+		int ret = sscanf(p, "%llu %i %7s", &time, &scancode, action);
+		Assert(ret == 3 && scancode < 0x80 && (strcmp(action, "down") == 0 || strcmp(action, "up") == 0),
+				"%s:%d: bad key record", filename, line_no);
+		Assert(nr_record == 0 || time >= record[nr_record - 1].time,
+				"%s:%d: key records are not sorted by time", filename, line_no);
+
+		if(nr_record == max_record) {
+			max_record *= 2;
+			record = realloc(record, max_record * sizeof(KeyRecord));
+			assert(record);
+		}
+		record[nr_record].time = time;
+		record[nr_record].scancode = scancode | (action[0] == 'u' ? 0x80 : 0);
+		nr_record ++;
+	}
+
+	fclose(fp);
+}
+
+void init_key_script() {
+	char *filename = getenv("NEMU_KEY_SCRIPT");
+	if(filename == NULL) {
+		return;
+	}
+
+	load_script(filename);
+	init_event(&script_event, replay);
+	schedule_next();
+}
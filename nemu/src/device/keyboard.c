@@ -1,29 +1,52 @@
 #include "device/port-io.h"
 #include "device/i8259.h"
+#include "device/event.h"
 #include "monitor/monitor.h"
 
 #define I8042_DATA_PORT 0x60
 #define KEYBOARD_IRQ 1
 
+/* Scancodes wait in this FIFO until the guest reads the data port,
+ * so that no key is lost when keys come faster than the guest reads. */
+#define KEY_FIFO_LEN 16
+
 static uint8_t *i8042_data_port_base;
-static bool newkey;
+static bool data_full;		/* the data port holds an unread scancode */
 
-void keyboard_intr(uint8_t scancode) {
-	if(nemu_state == RUNNING && newkey == false) {
-		i8042_data_port_base[0] = scancode;
+static uint8_t key_fifo[KEY_FIFO_LEN];
+static int key_head = 0, key_tail = 0;
+
+static Event refill_event;
+
+/* Move the next scancode into the data port. */
+static void i8042_load_data() {
+	if(!data_full && key_head != key_tail) {
+		i8042_data_port_base[0] = key_fifo[key_head % KEY_FIFO_LEN];
+		key_head ++;
+		data_full = true;
 		i8259_raise_intr(KEYBOARD_IRQ);
-		newkey = true;
+	}
+}
+
+void keyboard_intr(uint8_t scancode) {
+	if(nemu_state == RUNNING && key_tail - key_head < KEY_FIFO_LEN) {
+		key_fifo[key_tail % KEY_FIFO_LEN] = scancode;
+		key_tail ++;
+		i8042_load_data();
 	}
 }
 
 void i8042_io_handler(ioaddr_t addr, size_t len, bool is_write) {
-	if(!is_write) {
-		newkey = false;
+	if(!is_write && data_full) {
+		/* The scancode is read from the data port after this callback
+		 * returns, so the next one is loaded a little later. */
+		data_full = false;
+		event_add(&refill_event, 1);
 	}
 }
 
 void init_i8042() {
 	i8042_data_port_base = add_pio_map(I8042_DATA_PORT, 1, i8042_io_handler);
-	newkey = false;
+	data_full = false;
+	init_event(&refill_event, i8042_load_data);
 }
-
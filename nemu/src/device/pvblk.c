@@ -0,0 +1,180 @@
+#include "common.h"
+#include "memory/memory.h"
+#include "device/mmio.h"
+#include "device/i8259.h"
+#include "device/event.h"
+#include "device/disk.h"
+
+/* A paravirtual block device. Instead of moving data through I/O ports
+ * sector by sector, the guest puts requests into a ring in its memory
+ * and notifies the device by one write to the doorbell register. The
+ * device serves all new requests in a batch and raises one interrupt.
+ *
+ * register map (32-bit each):
+ *   0x00 MAGIC      read only, PVBLK_MAGIC
+ *   0x04 CAPACITY   read only, the number of sectors of the disk
+ *   0x08 RING_ADDR  the physical address of the ring
+ *   0x0c RING_SIZE  the number of request slots, must be a power of 2
+ *   0x10 DOORBELL   write anything to notify new requests
+ *   0x14 ISR        bit 0 is set when requests complete, bit 1 is set when
+ *                   the ring is invalid, write 1 to clear
+ *
+ * The ring starts with a header of two free-running indices. ``avail''
+ * is written by the guest after it fills a slot, and ``used'' is written
+ * by the device after it finishes a slot.
+ */
+
+#define PVBLK_ADDR 0x8000000	/* right after the physical memory */
+#define PVBLK_IRQ 11
+#define PVBLK_MAGIC 0x4b425650	/* "PVBK" */
+
+#define PVBLK_CMD_READ 0
+#define PVBLK_CMD_WRITE 1
+
+#define PVBLK_OK 0
+#define PVBLK_ERR 1
+
+/* the same timing model as the IDE disk */
+#define PVBLK_CMD_LATENCY_US 100
+#define PVBLK_SECTOR_LATENCY_US 5
+
+enum { MAGIC, CAPACITY, RING_ADDR, RING_SIZE, DOORBELL, ISR, NR_REG };
+
+typedef struct {
+	uint32_t cmd;
+	uint32_t sector;
+	uint32_t nr_sector;
+	uint32_t addr;		/* the physical address of the data buffer */
+	uint32_t status;	/* written by the device */
+	uint32_t pad[3];
+} PVBlkReq;
+
+typedef struct {
+	uint32_t avail;
+	uint32_t used;
+	uint32_t pad[6];
+	PVBlkReq req[0];
+} PVBlkRing;
+
+static uint32_t *pvblk_reg;
+static uint32_t isr;	/* the register space is overwritten by guest writes */
+static Event pvblk_event;
+
+/* requests in [ring->used, batch_end) are being served */
+static uint32_t batch_end;
+
+/* Return NULL if the ring set by the guest is not valid: the size
+ * is not a power of 2, or the ring is outside of the physical memory.
+ * The callers also check that the indices are at most a ring apart.
+ */
+static PVBlkRing* pvblk_ring() {
+	uint32_t size = pvblk_reg[RING_SIZE];
+	uint64_t end = (uint64_t)pvblk_reg[RING_ADDR] + sizeof(PVBlkRing) + (uint64_t)size * sizeof(PVBlkReq);
+	if(size == 0 || (size & (size - 1)) != 0 || end > HW_MEM_SIZE) {
+		return NULL;
+	}
+	return hwa_to_va(pvblk_reg[RING_ADDR]);
+}
+
+/* report completions, or an invalid ring if ``err'' is set */
+static void pvblk_notify(bool err) {
+	isr |= (err ? 0x2 : 0x1);
+	pvblk_reg[ISR] = isr;
+	i8259_raise_intr(PVBLK_IRQ);
+}
+
+static uint32_t serve(PVBlkReq *r) {
+	uint64_t offset = (uint64_t)r->sector << 9;
+	uint64_t len = (uint64_t)r->nr_sector << 9;
+	if(r->addr + len > HW_MEM_SIZE || offset + len > (1ull << 32)) {
+		return PVBLK_ERR;
+	}
+
+	if(r->cmd == PVBLK_CMD_READ) {
+		disk_read(hwa_to_va(r->addr), offset, len);
+	}
+	else if(r->cmd == PVBLK_CMD_WRITE) {
+		if(offset + len > disk_size) {
+			return PVBLK_ERR;
+		}
+		disk_write(offset, hwa_to_va(r->addr), len);
+	}
+	else {
+		return PVBLK_ERR;
+	}
+	return PVBLK_OK;
+}
+
+/* Take all requests available, and finish them as a batch. */
+static void pvblk_kick() {
+	if(event_pending(&pvblk_event)) {
+		/* New requests will be found when the current batch completes. */
+		return;
+	}
+
+	PVBlkRing *ring = pvblk_ring();
+	uint32_t mask = pvblk_reg[RING_SIZE] - 1;
+	uint32_t nr_sector = 0, i;
+
+	if(ring == NULL || ring->avail - ring->used > mask + 1) {
+		pvblk_notify(true);
+		return;
+	}
+
+	batch_end = ring->avail;
+	if(batch_end == ring->used) {
+		return;
+	}
+
+	for(i = ring->used; i != batch_end; i ++) {
+		nr_sector += ring->req[i & mask].nr_sector;
+	}
+	event_add(&pvblk_event, US_TO_INSTR(PVBLK_CMD_LATENCY_US + nr_sector * PVBLK_SECTOR_LATENCY_US));
+}
+
+static void pvblk_complete() {
+	PVBlkRing *ring = pvblk_ring();
+	uint32_t mask = pvblk_reg[RING_SIZE] - 1;
+	uint32_t i;
+
+	if(ring == NULL || batch_end - ring->used > mask + 1) {
+		/* the ring is changed during the batch */
+		pvblk_notify(true);
+		return;
+	}
+
+	for(i = ring->used; i != batch_end; i ++) {
+		PVBlkReq *r = &ring->req[i & mask];
+		r->status = serve(r);
+	}
+	ring->used = batch_end;
+	pvblk_notify(false);
+
+	/* serve the requests added during this batch */
+	pvblk_kick();
+}
+
+static void pvblk_io_handler(hwaddr_t addr, size_t len, bool is_write) {
+	int reg = (addr - PVBLK_ADDR) / 4;
+	if(is_write) {
+		switch(reg) {
+			case MAGIC: pvblk_reg[MAGIC] = PVBLK_MAGIC; break;
+			case CAPACITY: pvblk_reg[CAPACITY] = disk_size >> 9; break;
+			case DOORBELL: pvblk_kick(); break;
+			case ISR:
+				/* write 1 to clear */
+				isr &= ~pvblk_reg[ISR];
+				pvblk_reg[ISR] = isr;
+				break;
+		}
+	}
+}
+
+void init_pvblk() {
+	pvblk_reg = add_mmio_map(PVBLK_ADDR, NR_REG * 4, pvblk_io_handler);
+	memset(pvblk_reg, 0, NR_REG * 4);
+	pvblk_reg[MAGIC] = PVBLK_MAGIC;
+	pvblk_reg[CAPACITY] = disk_size >> 9;
+
+	init_event(&pvblk_event, pvblk_complete);
+}
@@ -0,0 +1,34 @@
+#include "common.h"
+#include "device/mmio.h"
+#include "device/clock.h"
+
+/* A monotonic counter of the virtual time in nanoseconds, so that
+ * the guest can measure time precisely without counting timer ticks.
+ *
+ * register map (32-bit each):
+ *   0x00 NS_LO   the low 32 bits of the time, reading it latches NS_HI
+ *   0x04 NS_HI   the high 32 bits of the time when NS_LO was read
+ *   0x08 TSC_HZ  read only, the frequency of the counter read by rdtsc
+ */
+
+#define RTC_ADDR 0x8001000
+
+enum { NS_LO, NS_HI, TSC_HZ, NR_REG };
+
+static uint32_t *rtc_reg;
+
+static void rtc_io_handler(hwaddr_t addr, size_t len, bool is_write) {
+	int reg = (addr - RTC_ADDR) / 4;
+	if(!is_write && reg == NS_LO) {
+		uint64_t ns = INSTR_TO_NS(vclock_now());
+		rtc_reg[NS_LO] = (uint32_t)ns;
+		rtc_reg[NS_HI] = ns >> 32;
+	}
+	rtc_reg[TSC_HZ] = INSTR_PER_SEC;
+}
+
+void init_rtc() {
+	rtc_reg = add_mmio_map(RTC_ADDR, NR_REG * 4, rtc_io_handler);
+	memset(rtc_reg, 0, NR_REG * 4);
+	rtc_reg[TSC_HZ] = INSTR_PER_SEC;
+}
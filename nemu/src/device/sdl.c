@@ -1,104 +1,178 @@
 #include "common.h"
 
-#ifdef HAS_DEVICE
+#if defined(HAS_DEVICE) && !defined(HEADLESS)
 
 #include "sdl.h"
 #include "vga.h"
+#include "device/event.h"
 
-#include <sys/time.h>
-#include <signal.h>
+#include <pthread.h>
 
 SDL_Surface *real_screen;
-SDL_Surface *screen;
-uint8_t (*pixel_buf) [SCREEN_COL];
-
-#define TIMER_HZ 100
-
-static uint64_t jiffy = 0;
-static struct itimerval it;
-static int device_update_flag = false;
-static int update_screen_flag = false;
-extern void timer_intr();
-extern void keyboard_intr();
-extern void update_screen();
-
-static void timer_sig_handler(int signum) {
-	jiffy ++;
-	timer_intr();
-
-	device_update_flag = true;
-	if(jiffy % (TIMER_HZ / VGA_HZ) == 0) {
-		update_screen_flag = true;
+
+/* All SDL work, including presenting frames and pumping the event
+ * queue, is done by the presentation thread, so the CPU thread is
+ * never stalled by the host display.
+ */
+static pthread_t render_thread;
+
+/* the time the presentation thread sleeps between two rounds */
+#define RENDER_DELAY_MS 5
+
+/* the frequency for the CPU thread to fetch keyboard input */
+#define INPUT_HZ 100
+
+static Event input_event;
+extern void keyboard_intr(uint8_t);
+
+/* Scancodes are passed from the presentation thread (producer)
+ * to the CPU thread (consumer) through this single-producer
+ * single-consumer queue. */
+#define KEY_QUEUE_LEN 64
+
+static uint8_t key_queue[KEY_QUEUE_LEN];
+static uint32_t key_head = 0;		/* written by the consumer */
+static uint32_t key_tail = 0;		/* written by the producer */
+static bool quit_request = false;
+
+static void key_queue_push(uint8_t scancode) {
+	uint32_t tail = key_tail;
+	if(tail - __atomic_load_n(&key_head, __ATOMIC_ACQUIRE) == KEY_QUEUE_LEN) {
+		/* the queue is full, drop the key */
+		return;
 	}
+	key_queue[tail % KEY_QUEUE_LEN] = scancode;
+	__atomic_store_n(&key_tail, tail + 1, __ATOMIC_RELEASE);
+}
 
-	int ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-	Assert(ret == 0, "Can not set timer");
+static int key_queue_pop() {
+	uint32_t head = key_head;
+	if(head == __atomic_load_n(&key_tail, __ATOMIC_ACQUIRE)) {
+		return -1;
+	}
+	uint8_t scancode = key_queue[head % KEY_QUEUE_LEN];
+	__atomic_store_n(&key_head, head + 1, __ATOMIC_RELEASE);
+	return scancode;
 }
 
-void device_update() {
-	if(!device_update_flag) {
-		return;
+/* CPU thread */
+static void input_poll() {
+	if(__atomic_load_n(&quit_request, __ATOMIC_ACQUIRE)) {
+		exit(0);
 	}
-	device_update_flag = false;
 
-	if(update_screen_flag) {
-		update_screen();
-		update_screen_flag = false;
+	int scancode;
+	while((scancode = key_queue_pop()) != -1) {
+		keyboard_intr(scancode);
 	}
 
+	event_add(&input_event, INSTR_PER_HZ(INPUT_HZ));
+}
+
+void sdl_clear_event_queue() {
+	while(key_queue_pop() != -1);
+}
+
+/* presentation thread */
+static void pump_events() {
 	SDL_Event event;
 	while(SDL_PollEvent(&event)) {
 		// If a key was pressed
 
 		uint32_t sym = event.key.keysym.sym;
 		if( event.type == SDL_KEYDOWN ) {
-			keyboard_intr(sym2scancode[sym >> 8][sym & 0xff]);
+			key_queue_push(sym2scancode[sym >> 8][sym & 0xff]);
 		}
 		else if( event.type == SDL_KEYUP ) {
-			keyboard_intr(sym2scancode[sym >> 8][sym & 0xff] | 0x80);
+			key_queue_push(sym2scancode[sym >> 8][sym & 0xff] | 0x80);
 		}
 
 		// If the user has Xed out the window
 		if( event.type == SDL_QUIT ) {
-			//Quit the program
-			exit(0);
+			//Let the CPU thread quit the program
+			__atomic_store_n(&quit_request, true, __ATOMIC_RELEASE);
 		}
 	}
 }
 
-void sdl_clear_event_queue() {
-	SDL_Event event;
-	while(SDL_PollEvent(&event));
+static void present_frame() {
+	static uint32_t lut_version = -1;
+	uint32_t dirty[NR_DIRTY_WORD];
+	Frame *f = vga_take_frame(dirty);
+
+	if(f->palette_version != lut_version) {
+		vga_update_palette_lut(f->palette);
+		lut_version = f->palette_version;
+	}
+
+	int i, k;
+	SDL_Rect rect[CTR_ROW];
+	int nr_rect = 0;
+	int pitch = real_screen->pitch;
+
+	if(SDL_MUSTLOCK(real_screen)) {
+		SDL_LockSurface(real_screen);
+	}
+
+	for(i = 0; i < CTR_ROW; i ++) {
+		if(dirty[i / 32] & (1u << (i % 32))) {
+			/* Convert the line directly into the host screen, and
+			 * duplicate it to get SCREEN_SCALE lines. */
+			void *row = real_screen->pixels + i * SCREEN_SCALE * pitch;
+			vga_scanout_line(row, f->vmem[i]);
+			for(k = 1; k < SCREEN_SCALE; k ++) {
+				memcpy(row + k * pitch, row, SCREEN_COL * sizeof(uint32_t));
+			}
+
+			/* merge adjacent dirty lines into one rectangle */
+			if(nr_rect > 0 && rect[nr_rect - 1].y + rect[nr_rect - 1].h == i * SCREEN_SCALE) {
+				rect[nr_rect - 1].h += SCREEN_SCALE;
+			}
+			else {
+				rect[nr_rect].x = 0;
+				rect[nr_rect].y = i * SCREEN_SCALE;
+				rect[nr_rect].w = SCREEN_COL;
+				rect[nr_rect].h = SCREEN_SCALE;
+				nr_rect ++;
+			}
+		}
+	}
+
+	if(SDL_MUSTLOCK(real_screen)) {
+		SDL_UnlockSurface(real_screen);
+	}
+
+	if(nr_rect > 0) {
+		SDL_UpdateRects(real_screen, nr_rect, rect);
+	}
 }
 
-void init_sdl() {
+static void* render_main(void *arg) {
+	/* SDL should be initialized in the thread using it. */
 	int ret = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_NOPARACHUTE);
 	Assert(ret == 0, "SDL_Init failed");
 
-	real_screen = SDL_SetVideoMode(640, 400, 8, 
-			SDL_HWSURFACE | SDL_HWPALETTE | SDL_HWACCEL | SDL_ASYNCBLIT);
-
-	screen = SDL_CreateRGBSurface(SDL_SWSURFACE, 640, 400, 8,
-			real_screen->format->Rmask, real_screen->format->Gmask,
-			real_screen->format->Bmask, real_screen->format->Amask);
-	pixel_buf = screen->pixels;
-
-	SDL_SetPalette(real_screen, SDL_LOGPAL | SDL_PHYSPAL, (void *)&palette, 0, 256);
-	SDL_SetPalette(screen, SDL_LOGPAL, (void *)&palette, 0, 256);
+	/* The video memory is converted into this 32-bit surface directly. */
+	real_screen = SDL_SetVideoMode(SCREEN_COL, SCREEN_ROW, 32, SDL_SWSURFACE);
+	Assert(real_screen && real_screen->format->BytesPerPixel == 4, "Can not set 32-bit video mode");
 
 	SDL_WM_SetCaption("NEMU", NULL);
 
 	SDL_EnableKeyRepeat(SDL_DEFAULT_REPEAT_DELAY, SDL_DEFAULT_REPEAT_INTERVAL);
 
-	struct sigaction s;
-	memset(&s, 0, sizeof(s));
-	s.sa_handler = timer_sig_handler;
-	ret = sigaction(SIGVTALRM, &s, NULL);
-	Assert(ret == 0, "Can not set signal handler");
+	while(true) {
+		pump_events();
+		present_frame();
+		SDL_Delay(RENDER_DELAY_MS);
+	}
+	return NULL;
+}
+
+void init_sdl() {
+	int ret = pthread_create(&render_thread, NULL, render_main, NULL);
+	Assert(ret == 0, "Can not create the presentation thread");
 
-	it.it_value.tv_sec = 0;
-	it.it_value.tv_usec = 1000000 / TIMER_HZ;
-	ret = setitimer(ITIMER_VIRTUAL, &it, NULL);
-	Assert(ret == 0, "Can not set timer");
+	init_event(&input_event, input_poll);
+	event_add(&input_event, INSTR_PER_HZ(INPUT_HZ));
 }
-#endif	/* HAS_DEVICE */
+#endif	/* HAS_DEVICE && !HEADLESS */
@@ -1,5 +1,14 @@
 #include "common.h"
+#include "memory/memory.h"
 #include "device/port-io.h"
+#include "device/event.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 
@@ -7,23 +16,165 @@
 #define CH_OFFSET 0
 #define LSR_OFFSET 5		/* line status register */
 
+#define LSR_THRE 0x20		/* transmitter holding register empty */
+#define LSR_TEMT 0x40		/* transmitter empty */
+
+/* The transmitter has a FIFO of 16 bytes, and the guest can push
+ * that many bytes for each check of the line status register.
+ * It takes SERIAL_FIFO_US to send out the whole FIFO. */
+#define FIFO_LEN 16
+#define SERIAL_FIFO_US 2
+
+/* A paravirtual port to output a whole buffer in one I/O:
+ *   +0 the physical address of the buffer
+ *   +4 the length of the buffer, writing it starts the output
+ *   +8 read only, SERIAL_PV_MAGIC
+ */
+#define SERIAL_PV_PORT 0x5F0
+#define SERIAL_PV_MAGIC 0x4c525350	/* "PSRL" */
+
+/* Guest output is collected in a host buffer, and written to the sink
+ * in bulk when the buffer is full, periodically, and when the guest stops.
+ * The sink is selected by the environment variable NEMU_SERIAL:
+ *   (unset)      stdout
+ *   file:PATH    the file PATH
+ *   unix:PATH    the Unix domain socket listening at PATH
+ */
+#define OUT_BUF_SIZE (64 * 1024)
+#define SERIAL_FLUSH_HZ 50
+
 static uint8_t *serial_port_base;
+static uint8_t *pv_port_base;
+
+static char out_buf[OUT_BUF_SIZE];
+static size_t out_len = 0;
+static int sink_fd = STDOUT_FILENO;
+
+static int fifo_cnt = 0;
+static Event fifo_event;
+static Event flush_event;
+
+void serial_flush() {
+	if(out_len == 0) {
+		return;
+	}
+
+	if(sink_fd == STDOUT_FILENO) {
+		/* keep the order with the messages from NEMU */
+		fflush(stdout);
+	}
+
+	size_t off = 0;
+	while(off < out_len) {
+		ssize_t ret = write(sink_fd, out_buf + off, out_len - off);
+		if(ret <= 0) {
+			/* the sink is gone, drop the output */
+			break;
+		}
+		off += ret;
+	}
+	out_len = 0;
+}
+
+static void serial_output(const void *buf, size_t len) {
+	while(len > 0) {
+		size_t n = OUT_BUF_SIZE - out_len;
+		if(n > len) { n = len; }
+		memcpy(out_buf + out_len, buf, n);
+		out_len += n;
+		buf += n;
+		len -= n;
+		if(out_len == OUT_BUF_SIZE) {
+			serial_flush();
+		}
+	}
+}
+
+static void fifo_drained() {
+	fifo_cnt = 0;
+	serial_port_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT;
+}
+
+static void periodic_flush() {
+	serial_flush();
+	event_add(&flush_event, INSTR_PER_HZ(SERIAL_FLUSH_HZ));
+}
 
 void serial_io_handler(ioaddr_t addr, size_t len, bool is_write) {
 	if(is_write) {
 		assert(len == 1);
 		if(addr == SERIAL_PORT + CH_OFFSET) {
-			char c = serial_port_base[CH_OFFSET];
-			/* We bind the serial port with the host stdout in NEMU. */
-			putc(c, stdout);
-			if(c == '\n') {
-				fflush(stdout);
+			if(fifo_cnt == FIFO_LEN) {
+				/* overrun, the byte is lost */
+				return;
+			}
+
+			serial_output(&serial_port_base[CH_OFFSET], 1);
+			if(fifo_cnt ++ == 0) {
+				serial_port_base[LSR_OFFSET] = 0;
+				event_add(&fifo_event, US_TO_INSTR(SERIAL_FIFO_US));
 			}
 		}
 	}
 }
 
+static void serial_pv_io_handler(ioaddr_t addr, size_t len, bool is_write) {
+	if(is_write) {
+		if(addr == SERIAL_PV_PORT + 4 && len == 4) {
+			hwaddr_t buf = *(uint32_t *)pv_port_base;
+			uint32_t buf_len = *(uint32_t *)(pv_port_base + 4);
+			if(buf_len <= HW_MEM_SIZE && buf <= HW_MEM_SIZE - buf_len) {
+				serial_output(hwa_to_va(buf), buf_len);
+			}
+			else {
+				/* the buffer is given by the guest, drop it */
+				Log("serial buffer 0x%x of %u bytes is outside of the physical memory", buf, buf_len);
+			}
+		}
+		*(uint32_t *)(pv_port_base + 8) = SERIAL_PV_MAGIC;
+	}
+}
+
+static void open_sink() {
+	char *sink = getenv("NEMU_SERIAL");
+	if(sink == NULL) {
+		return;
+	}
+
+	if(strncmp(sink, "file:", 5) == 0) {
+		sink_fd = open(sink + 5, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		Assert(sink_fd >= 0, "Can not open '%s'", sink + 5);
+	}
+	else if(strncmp(sink, "unix:", 5) == 0) {
+		struct sockaddr_un sa;
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		strncpy(sa.sun_path, sink + 5, sizeof(sa.sun_path) - 1);
+
+		sink_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		Assert(sink_fd >= 0, "Can not create socket");
+		int ret = connect(sink_fd, (struct sockaddr *)&sa, sizeof(sa));
+		Assert(ret == 0, "Can not connect to '%s'", sink + 5);
+
+		/* write() fails instead of killing NEMU if the peer goes away */
+		signal(SIGPIPE, SIG_IGN);
+	}
+	else {
+		Assert(0, "Unknown serial sink '%s'", sink);
+	}
+}
+
 void init_serial() {
 	serial_port_base = add_pio_map(SERIAL_PORT, 8, serial_io_handler);
-	serial_port_base[LSR_OFFSET] = 0x20; /* the status is always free */
+	serial_port_base[LSR_OFFSET] = LSR_THRE | LSR_TEMT;
+
+	pv_port_base = add_pio_map(SERIAL_PV_PORT, 12, serial_pv_io_handler);
+	*(uint32_t *)(pv_port_base + 8) = SERIAL_PV_MAGIC;
+
+	open_sink();
+	atexit(serial_flush);
+
+	init_event(&fifo_event, fifo_drained);
+	init_event(&flush_event, periodic_flush);
+	event_add(&flush_event, INSTR_PER_HZ(SERIAL_FLUSH_HZ));
 }
@@ -1,7 +1,11 @@
 #include "device/i8259.h"
+#include "device/event.h"
 #include "monitor/monitor.h"
 
 #define TIMER_IRQ 0
+#define TIMER_HZ 100
+
+static Event timer_event;
 
 void timer_intr() {
 	if(nemu_state == RUNNING) {
@@ -9,5 +13,12 @@ void timer_intr() {
 	}
 }
 
+static void timer_tick() {
+	timer_intr();
+	event_add(&timer_event, INSTR_PER_HZ(TIMER_HZ));
+}
+
 void init_timer() {
+	init_event(&timer_event, timer_tick);
+	event_add(&timer_event, INSTR_PER_HZ(TIMER_HZ));
 }
@@ -0,0 +1,61 @@
+#include "common.h"
+
+#ifdef HAS_DEVICE
+#include "vga.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+uint32_t palette_lut[256];
+
+void vga_update_palette_lut(const Color *pal) {
+	int i;
+	for(i = 0; i < 256; i ++) {
+#ifdef HEADLESS
+		palette_lut[i] = (pal[i].r << 16) | (pal[i].g << 8) | pal[i].b;
+#else
+		palette_lut[i] = SDL_MapRGB(real_screen->format, pal[i].r, pal[i].g, pal[i].b);
+#endif
+	}
+}
+
+/* Convert one line of video memory into host pixels through the palette,
+ * with each pixel repeated SCREEN_SCALE times horizontally.
+ */
+void vga_scanout_line(uint32_t *dst, const uint8_t *src) {
+	int i = 0;
+
+#if SCREEN_SCALE == 2 && defined(__AVX2__)
+	for(; i + 8 <= CTR_COL; i += 8) {
+		__m256i idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		__m256i pix = _mm256_i32gather_epi32((const int *)palette_lut, idx, 4);
+		/* lo = p0 p0 p1 p1 | p4 p4 p5 p5, hi = p2 p2 p3 p3 | p6 p6 p7 p7 */
+		__m256i lo = _mm256_unpacklo_epi32(pix, pix);
+		__m256i hi = _mm256_unpackhi_epi32(pix, pix);
+		_mm256_storeu_si256((__m256i *)(dst + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + 2 * i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+#elif SCREEN_SCALE == 2 && defined(__SSE2__)
+	for(; i + 4 <= CTR_COL; i += 4) {
+		__m128i pix = _mm_set_epi32(palette_lut[src[i + 3]], palette_lut[src[i + 2]],
+				palette_lut[src[i + 1]], palette_lut[src[i]]);
+		_mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi32(pix, pix));
+		_mm_storeu_si128((__m128i *)(dst + 2 * i + 4), _mm_unpackhi_epi32(pix, pix));
+	}
+#endif
+
+	/* the generic path for the remaining pixels and other scale factors */
+	dst += i * SCREEN_SCALE;
+	for(; i < CTR_COL; i ++) {
+		uint32_t p = palette_lut[src[i]];
+		int k;
+		for(k = 0; k < SCREEN_SCALE; k ++) {
+			*dst ++ = p;
+		}
+	}
+}
+
+#endif	/* HAS_DEVICE */
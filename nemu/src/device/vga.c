@@ -3,9 +3,10 @@
 #ifdef HAS_DEVICE
 
 #include "vga.h"
+#include "memory/memory.h"
 #include "device/port-io.h"
-#include "device/mmio.h"
 #include "device/i8259.h"
+#include "device/event.h"
 
 enum {Horizontal_Total_Register, End_Horizontal_Display_Register, 
 	Start_Horizontal_Blanking_Register, End_Horizontal_Blanking_Register,
@@ -30,53 +31,92 @@ static uint8_t vga_crtc_regs[19];
 #define VGA_CRTC_INDEX		0x3D4
 #define VGA_CRTC_DATA		0x3D5
 
-#define CTR_ROW 200
-#define CTR_COL 320
+#define VMEM_ADDR 0xa0000
 
-static void *vmem_base;
-bool vmem_dirty = false;
-bool line_dirty[CTR_ROW];
+/* The video memory is ordinary RAM, so guest writes to it go through
+ * the fast path of the memory bus without any callback. Dirty lines
+ * are found by comparing with ``vmem_shadow'' at refresh time.
+ */
+static uint8_t (*vmem) [CTR_COL];
+static uint8_t vmem_shadow[CTR_ROW][CTR_COL];
+static Event refresh_event;
+static bool palette_dirty = false;
+static uint32_t palette_version = 0;
 
-void vga_vmem_io_handler(hwaddr_t addr, size_t len, bool is_write) {
-	if(is_write) {
-		int line = (addr - 0xa0000) / CTR_COL;
-		if(line < CTR_ROW) {
-			line_dirty[line] = true;
+/* Completed frames are handed over to the presentation thread through
+ * a triple buffer. The CPU thread fills ``frames[frame_back]'', then
+ * swaps it with ``frame_ready''. The presentation thread swaps its own
+ * frame with ``frame_ready'' when FRAME_NEW is set.
+ */
+#define FRAME_NEW 0x4
+
+static Frame frames[3];
+static int frame_back = 0;
+static int frame_ready = 1;
+static int frame_front = 2;
+
+/* Lines changed since the presentation thread last looked. They are
+ * set only after the frame containing them is published. */
+static uint32_t dirty_bits[NR_DIRTY_WORD];
+
+static void vga_publish_frame() {
+	uint32_t new_dirty[NR_DIRTY_WORD];
+	memset(new_dirty, 0, sizeof(new_dirty));
+	bool vmem_dirty = false;
+
+	int i;
+	for(i = 0; i < CTR_ROW; i ++) {
+		if(palette_dirty || memcmp(vmem[i], vmem_shadow[i], CTR_COL) != 0) {
+			memcpy(vmem_shadow[i], vmem[i], CTR_COL);
+			new_dirty[i / 32] |= 1u << (i % 32);
 			vmem_dirty = true;
 		}
 	}
+
+	if(!vmem_dirty) {
+		return;
+	}
+
+	Frame *f = &frames[frame_back];
+	memcpy(f->vmem, vmem_shadow, sizeof(vmem_shadow));
+	memcpy(f->palette, palette, sizeof(f->palette));
+	f->palette_version = palette_version;
+
+	frame_back = __atomic_exchange_n(&frame_ready, frame_back | FRAME_NEW, __ATOMIC_ACQ_REL) & ~FRAME_NEW;
+
+	for(i = 0; i < NR_DIRTY_WORD; i ++) {
+		__atomic_or_fetch(&dirty_bits[i], new_dirty[i], __ATOMIC_RELEASE);
+	}
+
+	palette_dirty = false;
 }
 
-void do_update_screen_graphic_mode() {
-	int i, j;
-	uint8_t (*vmem) [CTR_COL] = vmem_base;
-	SDL_Rect rect;
-	rect.x = 0;
-	rect.w = CTR_COL * 2;
-	rect.h = 2;
+/* presentation thread interface */
+Frame* vga_take_frame(uint32_t *dirty) {
+	int i;
+	/* Fetch the dirty lines before the frame, so that the frame
+	 * is at least as new as the dirty lines. */
+	for(i = 0; i < NR_DIRTY_WORD; i ++) {
+		dirty[i] = __atomic_exchange_n(&dirty_bits[i], 0, __ATOMIC_ACQUIRE);
+	}
 
-	for(i = 0; i < CTR_ROW; i ++) {
-		if(line_dirty[i]) {
-			for(j = 0; j < CTR_COL; j ++) {
-				uint8_t color_idx = vmem[i][j];
-				draw_pixel(2 * j, 2 * i, color_idx);
-				draw_pixel(2 * j, 2 * i + 1, color_idx);
-				draw_pixel(2 * j + 1, 2 * i, color_idx);
-				draw_pixel(2 * j + 1, 2 * i + 1, color_idx);
-			}
-			rect.y = i * 2;
-			SDL_BlitSurface(screen, &rect, real_screen, &rect);
-		}
+	if(__atomic_load_n(&frame_ready, __ATOMIC_ACQUIRE) & FRAME_NEW) {
+		frame_front = __atomic_exchange_n(&frame_ready, frame_front, __ATOMIC_ACQ_REL) & ~FRAME_NEW;
 	}
-	SDL_Flip(real_screen);
+	return &frames[frame_front];
 }
 
 void update_screen() {
-	if(vmem_dirty) {
-		do_update_screen_graphic_mode();
-		vmem_dirty = false;
-		memset(line_dirty, false, CTR_ROW);
-	}
+	vga_publish_frame();
+}
+
+static void vga_refresh() {
+	update_screen();
+#ifdef HEADLESS
+	extern void headless_present();
+	headless_present();
+#endif
+	event_add(&refresh_event, INSTR_PER_HZ(VGA_HZ));
 }
 
 void vga_dac_io_handler(ioaddr_t addr, size_t len, bool is_write) {
@@ -86,11 +126,12 @@ void vga_dac_io_handler(ioaddr_t addr, size_t len, bool is_write) {
 	}
 	else if(addr == VGA_DAC_DATA && is_write) {
 		*color_ptr++ = vga_dac_port_base[1] << 2;
-		if( (((void *)color_ptr - (void *)&screen->format->palette->colors) & 0x3) == 3) {
+		if( (((void *)color_ptr - (void *)palette) & 0x3) == 3) {
 			color_ptr ++;
 			if((void *)color_ptr == (void *)&palette[256]) {
-				SDL_SetPalette(real_screen, SDL_LOGPAL | SDL_PHYSPAL, (void *)&palette, 0, 256);
-				SDL_SetPalette(screen, SDL_LOGPAL, (void *)&palette, 0, 256);
+				/* Every pixel on the host screen should be converted again. */
+				palette_version ++;
+				palette_dirty = true;
 			}
 		}
 	}
@@ -108,6 +149,9 @@ void vga_crtc_io_handler(ioaddr_t addr, size_t len, bool is_write) {
 void init_vga() {
 	vga_dac_port_base = add_pio_map(VGA_DAC_WRITE_INDEX, 2, vga_dac_io_handler);
 	vga_crtc_port_base = add_pio_map(VGA_CRTC_INDEX, 2, vga_crtc_io_handler);
-	vmem_base = add_mmio_map(0xa0000, 0x20000, vga_vmem_io_handler);
+	vmem = hwa_to_va(VMEM_ADDR);
+
+	init_event(&refresh_event, vga_refresh);
+	event_add(&refresh_event, INSTR_PER_HZ(VGA_HZ));
 }
 #endif	/* HAS_DEVICE */
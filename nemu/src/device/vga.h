@@ -2,21 +2,24 @@
 #define __VGA_H__
 
 #include "common.h"
+
+#ifndef HEADLESS
 #include <SDL/SDL.h>
+#endif
+
+#define CTR_ROW 200
+#define CTR_COL 320
 
-#define SCREEN_ROW 400
-#define SCREEN_COL 640
+/* Each pixel in the video memory is displayed as
+ * SCREEN_SCALE x SCREEN_SCALE pixels on the host. */
+#define SCREEN_SCALE 2
+#define SCREEN_ROW (CTR_ROW * SCREEN_SCALE)
+#define SCREEN_COL (CTR_COL * SCREEN_SCALE)
 #define VGA_HZ 25
 
+#ifndef HEADLESS
 extern SDL_Surface *real_screen;
-extern SDL_Surface *screen;
-
-extern uint8_t (*pixel_buf) [SCREEN_COL];
-
-static inline void draw_pixel(int x, int y, uint8_t color_idx) {
-	assert(x >= 0 && x < SCREEN_COL && y >= 0 && y < SCREEN_ROW);
-	pixel_buf[y][x] = color_idx;
-}
+#endif
 
 typedef union {
 	uint32_t val;
@@ -27,4 +30,21 @@ typedef union {
 
 extern Color palette[];
 
+/* a complete frame handed over to the presentation thread */
+typedef struct {
+	uint8_t vmem[CTR_ROW][CTR_COL];
+	Color palette[256];
+	uint32_t palette_version;
+} Frame;
+
+#define NR_DIRTY_WORD ((CTR_ROW + 31) / 32)
+
+Frame* vga_take_frame(uint32_t *);
+
+/* color index -> 32-bit host pixel */
+extern uint32_t palette_lut[];
+
+void vga_update_palette_lut(const Color *);
+void vga_scanout_line(uint32_t *, const uint8_t *);
+
 #endif
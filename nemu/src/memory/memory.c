@@ -1,4 +1,5 @@
 #include "common.h"
+#include "device/mmio.h"
 
 uint32_t dram_read(hwaddr_t, size_t);
 void dram_write(hwaddr_t, size_t, uint32_t);
@@ -6,10 +7,23 @@ void dram_write(hwaddr_t, size_t, uint32_t);
 /* Memory accessing interfaces */
 
 uint32_t hwaddr_read(hwaddr_t addr, size_t len) {
+#ifdef HAS_DEVICE
+	int map_NO = is_mmio(addr);
+	if(map_NO != -1) {
+		return mmio_read(addr, len, map_NO);
+	}
+#endif
 	return dram_read(addr, len) & (~0u >> ((4 - len) << 3));
 }
 
 void hwaddr_write(hwaddr_t addr, size_t len, uint32_t data) {
+#ifdef HAS_DEVICE
+	int map_NO = is_mmio(addr);
+	if(map_NO != -1) {
+		mmio_write(addr, len, data, map_NO);
+		return;
+	}
+#endif
 	dram_write(addr, len, data);
 }
 
@@ -1,5 +1,7 @@
 #include "monitor/monitor.h"
 #include "cpu/helper.h"
+#include "device/clock.h"
+#include "device/i8259.h"
 #include <setjmp.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -9,9 +11,16 @@
  */
 #define MAX_INSTR_TO_PRINT 10
 
+/* The maximum number of instructions to run before checking the
+ * interrupt line again, which bounds the interrupt latency even if
+ * no device event is pending. */
+#define MAX_CHUNK_INSTR 65536
+
 int nemu_state = STOP;
+uint32_t exit_request = 0;
 
 int exec(swaddr_t);
+void raise_intr(uint8_t);
 
 char assembly[80];
 char asm_buf[128];
@@ -32,6 +41,37 @@ void print_bin_instr(swaddr_t eip, int len) {
 void do_int3() {
 	printf("\nHit breakpoint at eip = 0x%08x\n", cpu.eip);
 	nemu_state = STOP;
+	cpu_exit_request(EXIT_REQ_STOP);
+}
+
+/* Called at chunk boundaries, instead of after each instruction.
+ * The interrupt line is checked here, and nowhere else, so the delivery
+ * of an interrupt costs nothing on the path of ordinary instructions.
+ */
+static void check_intr() {
+	__atomic_and_fetch(&exit_request, ~EXIT_REQ_INTR, __ATOMIC_ACQUIRE);
+
+	if(cpu.INTR) {
+		/* TODO: Respond to the interrupt only if the IF flag is set,
+		 * once EFLAGS is there. Instructions which set the IF flag
+		 * (sti, popf, iret) should then request an exit with
+		 * EXIT_REQ_INTR, so that a pending interrupt is checked at once.
+		 */
+		uint8_t NO = i8259_query_intr();
+		i8259_ack_intr();
+		raise_intr(NO);
+	}
+}
+
+/* The virtual clock advances by one for each executed instruction.
+ * ``vclock'' is only brought up to date between chunks, and the exact
+ * time inside a chunk is recovered from the number of instructions left.
+ */
+static volatile uint64_t vclock_end;
+static volatile uint32_t *instr_left = NULL;
+
+uint64_t vclock_now() {
+	return (instr_left != NULL ? vclock_end - *instr_left : vclock);
 }
 
 /* Simulate how the CPU works. */
@@ -41,48 +81,88 @@ void cpu_exec(volatile uint32_t n) {
 		return;
 	}
 	nemu_state = RUNNING;
+	__atomic_and_fetch(&exit_request, ~EXIT_REQ_STOP, __ATOMIC_RELAXED);
 
 #ifdef DEBUG
 	volatile uint32_t n_temp = n;
 #endif
 
+	/* Since ``n'' survives longjmp(), we can always recover the clock from it. */
+	vclock_end = vclock + n;
+	instr_left = &n;
+
 	setjmp(jbuf);
 
-	for(; n > 0; n --) {
-#ifdef DEBUG
-		swaddr_t eip_temp = cpu.eip;
-		if((n & 0xffff) == 0) {
-			/* Output some dots while executing the program. */
-			fputc('.', stderr);
+	while(n > 0) {
+		/* Run straight until the next device event, or until the
+		 * chunk is used up. */
+		uint32_t n_stop = (n > MAX_CHUNK_INSTR ? n - MAX_CHUNK_INSTR : 0);
+#ifdef HAS_DEVICE
+		vclock = vclock_end - n;
+		__atomic_and_fetch(&exit_request, ~EXIT_REQ_EVENT, __ATOMIC_RELAXED);
+		if(clock_deadline - vclock < n - n_stop) {
+			n_stop = n - (clock_deadline - vclock);
 		}
+		chunk_end = vclock + (n - n_stop);
 #endif
 
-		/* Execute one instruction, including instruction fetch,
-		 * instruction decode, and the actual execution. */
-		int instr_len = exec(cpu.eip);
+		for(; n > n_stop; n --) {
+#ifdef DEBUG
+			swaddr_t eip_temp = cpu.eip;
+			if((n & 0xffff) == 0) {
+				/* Output some dots while executing the program. */
+				fputc('.', stderr);
+			}
+#endif
+
+			/* Execute one instruction, including instruction fetch,
+			 * instruction decode, and the actual execution. */
+			int instr_len = exec(cpu.eip);
 
-		cpu.eip += instr_len;
+			cpu.eip += instr_len;
 
 #ifdef DEBUG
-		print_bin_instr(eip_temp, instr_len);
-		strcat(asm_buf, assembly);
-		Log_write("%s\n", asm_buf);
-		if(n_temp < MAX_INSTR_TO_PRINT) {
-			printf("%s\n", asm_buf);
-		}
+			print_bin_instr(eip_temp, instr_len);
+			strcat(asm_buf, assembly);
+			Log_write("%s\n", asm_buf);
+			if(n_temp < MAX_INSTR_TO_PRINT) {
+				printf("%s\n", asm_buf);
+			}
 #endif
 
-		/* TODO: check watchpoints here. */
+			/* TODO: check watchpoints here. To stop the execution, also
+			 * call cpu_exit_request(EXIT_REQ_STOP) besides setting
+			 * ``nemu_state''. */
 
 
-		if(nemu_state != RUNNING) { return; }
+			/* A relaxed load is a plain load on the host, as cheap as
+			 * the check of ``nemu_state'' it replaces. */
+			if(__atomic_load_n(&exit_request, __ATOMIC_RELAXED)) { n --; break; }
+		}
+
+		vclock = vclock_end - n;
+		if(nemu_state != RUNNING) { break; }
 
 #ifdef HAS_DEVICE
-		extern void device_update();
-		device_update();
+		if(vclock >= clock_deadline) {
+			extern void device_update();
+			device_update();
+		}
 #endif
 
+		check_intr();
 	}
 
+#ifdef HAS_DEVICE
+	/* Make the output of the guest visible when it stops. */
+	extern void serial_flush();
+	serial_flush();
+#endif
+
+	instr_left = NULL;
+#ifdef HAS_DEVICE
+	chunk_end = -1;
+#endif
+
 	if(nemu_state == RUNNING) { nemu_state = STOP; }
 }